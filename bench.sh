@@ -0,0 +1,144 @@
+#! /bin/bash
+
+set -e
+set -u
+
+v=${v:-./v}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# Run a command a few times and print the best wall clock time in seconds
+best_time()
+{
+	local best=
+	for i in 1 2 3; do
+		local start=$(date +%s.%N)
+		"$@" >/dev/null || { echo "$*: failed" >&2; exit 1; }
+		local end=$(date +%s.%N)
+		best=$(awk -v s=$start -v e=$end -v b="$best" 'BEGIN { t = e - s; if (b != "" && b < t) t = b; printf "%.6f", t }')
+	done
+	echo $best
+}
+
+# Synthetic input that looks like generated code: lots of definitions,
+# calls, operators, comments and string literals.
+gen_parser_input()
+{
+	awk -v n=$1 'BEGIN {
+		for (i = 0; i < n; ++i) {
+			printf "# generated definition %d\n", i
+			printf "value_%d := some_function_name_%d(argument_one + u64 %d, argument_two * %d, \"string %d\");\n", i, i % 97, i, i % 13, i
+			printf "if (value_%d < u64 %d) { print value_%d; } else { other_%d = value_%d - u64 1; };\n", i, i, i, i, i
+		}
+	}'
+}
+
+# Kept small enough that the old recursive parser doesn't run out of
+# stack on it, so that numbers can be compared across versions
+echo "parser:"
+gen_parser_input 10000 > $tmp/parser.v
+size=$(stat -c %s $tmp/parser.v)
+t=$(best_time $v --no-compile $tmp/parser.v)
+echo "$size $t" | awk '{ printf "  %.1f MB in %.3f s: %.1f MB/s\n", $1 / 1e6, $2, $1 / 1e6 / $2 }'
+
+echo "ast cache:"
+t=$(best_time $v --no-compile $tmp/parser.v)
+echo "  no cache:     $t s"
+# Every run writes a new cache file since we change the source each time
+t=$(best_time sh -c "echo '# \$\$' >> $tmp/parser.v && exec $v --ast-cache=$tmp/cache --no-compile $tmp/parser.v")
+echo "  invalidated:  $t s"
+$v --ast-cache=$tmp/cache --no-compile $tmp/parser.v
+t=$(best_time $v --ast-cache=$tmp/cache --no-compile $tmp/parser.v)
+echo "  warm:         $t s"
+
+echo "many files ($(nproc) cpus):"
+mkdir $tmp/many
+for i in $(seq 300); do
+	gen_parser_input 200 > $tmp/many/$i.v
+done
+for j in 1 2 4 8; do
+	t=$(best_time $v -j $j --no-compile $tmp/many/*.v)
+	echo "  -j $j: $t s"
+done
+
+# Functions with loops and conditionals, so that compiling them goes
+# through most of the usual macros, scopes and contexts.
+gen_compile_input()
+{
+	awk -v n=$1 'BEGIN {
+		for (i = 0; i < n; ++i) {
+			printf "@f_%d := (fun u64(u64, u64)) (a, b) {\n", i
+			printf "\tc := (a + b) - (u64 %d);\n", i
+			printf "\twhile (c != u64 0) {\n\t\tif (c < b) (b = b - c) else (c = c - b);\n\t};\n"
+			printf "\treturn c;\n};\n"
+			printf "x_%d := f_%d(u64 %d, u64 3);\n", i, i, i
+		}
+	}'
+}
+
+# Per node, not counting the time it takes to parse them
+echo "compile:"
+gen_compile_input 2000 > $tmp/compile.v
+nodes=$($v --dump-ast-stats --no-compile $tmp/compile.v | awk '{ print $2 }')
+t_parse=$(best_time $v --no-compile $tmp/compile.v)
+t=$(best_time $v --no-run $tmp/compile.v)
+echo "$nodes $t_parse $t" | awk '{ printf "  %d nodes in %.3f s: %.0f ns/node\n", $1, $3 - $2, ($3 - $2) * 1e9 / $1 }'
+if perf stat -e instructions:u true >/dev/null 2>&1; then
+	instructions()
+	{
+		perf stat -x, -e instructions:u "$@" 2>&1 >/dev/null | awk -F, '/instructions/ { print $1 }'
+	}
+
+	i_parse=$(instructions $v --no-compile $tmp/compile.v)
+	i=$(instructions $v --no-run $tmp/compile.v)
+	echo "$nodes $i_parse $i" | awk '{ printf "  %.0f instructions/node\n", ($3 - $2) / $1 }'
+fi
+
+# Every eval is a new (nested) context, and every macro invocation
+# checks the value against the current context's ancestors
+gen_nested_evals()
+{
+	awk -v n=$1 -v m=$2 'BEGIN {
+		terms = ""
+		for (i = 0; i < m; ++i)
+			terms = terms "(u64 1) + "
+
+		s = "(u64 1)"
+		for (i = 0; i < n; ++i)
+			s = "@(" terms s ")"
+
+		print "x := " s ";"
+		print "print x;"
+	}'
+}
+
+echo "nested evals:"
+gen_nested_evals 400 100 > $tmp/evals.v
+t=$(best_time $v $tmp/evals.v)
+echo "  400 deep: $t s"
+
+# Compile-time code all runs in the bytecode interpreter
+echo "interpreter:"
+sed 's/fib(u64 18)/fib(u64 30)/' tests/integration/fib.v > $tmp/fib.v
+t=$(best_time $v $tmp/fib.v)
+echo "  fib(30), direct threaded:      $t s"
+t=$(best_time $v -Xno-direct-threading $tmp/fib.v)
+echo "  fib(30), switch:               $t s"
+t=$(best_time $v -Xno-superinstructions $tmp/fib.v)
+echo "  fib(30), no superinstructions: $t s"
+
+# What fuse_superinstructions() should be fusing: the most common
+# pairs of instructions that are actually executed
+echo "opcode pairs:"
+for file in tests/integration/*.v; do
+	$v -Xno-superinstructions -Xtrace-bytecode $file
+done | sed 's/\x1b\[[0-9;]*m//g' | awk '$1 == "[trace-bytecode]" && $2 ~ /^[0-9]+:$/ { if (prev != "") print prev, $3; prev = $3 }' | sort | uniq -c | sort -rn | head -10
+
+echo "lexer scanners:"
+g++ -std=c++14 -Wall -Wfatal-errors -O2 -Isrc -o $tmp/lexer bench/lexer.cc
+$tmp/lexer
+
+echo "line numbers:"
+g++ -std=c++14 -Wall -Wfatal-errors -O2 -Isrc -o $tmp/line_numbers bench/line_numbers.cc
+$tmp/line_numbers
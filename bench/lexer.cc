@@ -0,0 +1,156 @@
+//
+//  V compiler
+//  Copyright (C) 2017  Vegard Nossum <vegard.nossum@gmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Microbenchmarks for the lexer's character class scanners. Every
+// scanner is run over an input that consists mostly of the character
+// class it is looking for, once for each implementation; we also check
+// that all the implementations agree.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "lexer.hh"
+
+static const lexer_scanners *all_scanners[] = {
+	&scalar_scanners,
+#ifdef __x86_64__
+	&sse2_scanners,
+	&avx2_scanners,
+#endif
+};
+
+// Runs of between 1 and 'max_run' bytes taken from 'chars', each
+// followed by a single byte from 'separators'
+static std::string gen_input(const char *chars, const char *separators, unsigned int max_run, size_t size)
+{
+	std::string result;
+	result.reserve(size + max_run + 1);
+
+	size_t nr_chars = strlen(chars);
+	size_t nr_separators = strlen(separators);
+
+	srand(1);
+	while (result.size() < size) {
+		unsigned int n = 1 + rand() % max_run;
+		for (unsigned int i = 0; i < n; ++i)
+			result.push_back(chars[rand() % nr_chars]);
+
+		result.push_back(separators[rand() % nr_separators]);
+	}
+
+	return result;
+}
+
+// Scan the whole input, stepping over the separators
+static unsigned long scan_all(scan_fn scan, const std::string &input)
+{
+	const char *buf = input.data();
+	unsigned int len = input.size();
+
+	unsigned long checksum = 0;
+	unsigned int i = 0;
+	while (i < len) {
+		i = scan(buf, i, len);
+		checksum += i;
+		++i;
+	}
+
+	return checksum;
+}
+
+static bool is_cpu_supported(const lexer_scanners *s)
+{
+#ifdef __x86_64__
+	if (s == &avx2_scanners)
+		return __builtin_cpu_supports("avx2");
+#endif
+
+	return true;
+}
+
+template<typename Fn>
+static void bench(const char *name, const char *impl, size_t size, Fn fn)
+{
+	const unsigned int nr_iterations = 20;
+
+	double best = 0;
+	for (unsigned int i = 0; i < nr_iterations; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		auto end = std::chrono::steady_clock::now();
+
+		double t = std::chrono::duration<double>(end - start).count();
+		if (i == 0 || t < best)
+			best = t;
+	}
+
+	printf("  %-12s %-8s %8.1f MB/s\n", name, impl, size / 1e6 / best);
+}
+
+static void bench_scanner(const char *name, scan_fn lexer_scanners::*scanner, const std::string &input)
+{
+	unsigned long expected = scan_all(scalar_scanners.*scanner, input);
+
+	for (const lexer_scanners *s: all_scanners) {
+		if (!is_cpu_supported(s))
+			continue;
+
+		if (scan_all(s->*scanner, input) != expected) {
+			fprintf(stderr, "%s: %s scanner disagrees with scalar scanner\n", name, s->name);
+			exit(EXIT_FAILURE);
+		}
+
+		volatile unsigned long result;
+		bench(name, s->name, input.size(), [&]() {
+			result = scan_all(s->*scanner, input);
+		});
+	}
+}
+
+int main()
+{
+	const size_t size = 16 << 20;
+
+	printf("default: %s\n", default_scanners->name);
+
+	bench_scanner("whitespace", &lexer_scanners::whitespace,
+		gen_input(" \t\n", "x", 64, size));
+	bench_scanner("symbol_name", &lexer_scanners::symbol_name,
+		gen_input("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", " .(", 48, size));
+	bench_scanner("digits", &lexer_scanners::digits,
+		gen_input("0123456789", " ,", 24, size));
+
+	// Comments are found with memchr(), so there's only one version
+	std::string comments = gen_input("abcdefghijklmnopqrstuvwxyz ", "\n", 80, size);
+	for (size_t i = 0; i < comments.size(); ++i) {
+		if (i == 0 || comments[i - 1] == '\n')
+			comments[i] = '#';
+	}
+
+	volatile unsigned int result;
+	bench("comments", "memchr", comments.size(), [&]() {
+		unsigned int i = 0;
+		lexer(comments.data(), comments.size()).skip_whitespace_and_comments(i);
+		result = i;
+	});
+
+	return EXIT_SUCCESS;
+}
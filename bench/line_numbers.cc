@@ -0,0 +1,81 @@
+//
+//  V compiler
+//  Copyright (C) 2017  Vegard Nossum <vegard.nossum@gmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Building the line table for a big source file, and looking up random
+// offsets in it.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "line_number_info.hh"
+
+template<typename Fn>
+static double best_time(Fn fn)
+{
+	const unsigned int nr_iterations = 10;
+
+	double best = 0;
+	for (unsigned int i = 0; i < nr_iterations; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		auto end = std::chrono::steady_clock::now();
+
+		double t = std::chrono::duration<double>(end - start).count();
+		if (i == 0 || t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+int main()
+{
+	const size_t size = 16 << 20;
+	const unsigned int nr_lookups = 1 << 20;
+
+	// Lines of between 1 and 80 bytes
+	std::string input;
+	input.reserve(size + 81);
+
+	srand(1);
+	while (input.size() < size) {
+		input.append(rand() % 80, 'x');
+		input.push_back('\n');
+	}
+
+	volatile unsigned int result;
+
+	double t = best_time([&]() {
+		line_number_info line_numbers(input.data(), input.size());
+		result = line_numbers.line_starts.size();
+	});
+	printf("  build:  %.1f MB in %.3f ms\n", input.size() / 1e6, t * 1e3);
+
+	line_number_info line_numbers(input.data(), input.size());
+	t = best_time([&]() {
+		unsigned int sum = 0;
+		for (unsigned int i = 0; i < nr_lookups; ++i)
+			sum += line_numbers.lookup((i * 2654435761u) % input.size()).line;
+		result = sum;
+	});
+	printf("  lookup: %.1f ns\n", t * 1e9 / nr_lookups);
+
+	return EXIT_SUCCESS;
+}
@@ -3,4 +3,4 @@
 set -e
 set -u
 
-g++ -std=c++14 -Wall -Wfatal-errors -Isrc -g -o v src/main.cc -lgmp -lgmpxx
+g++ -std=c++14 -Wall -Wfatal-errors -Isrc -g -pthread -o v src/main.cc -lgmp -lgmpxx
@@ -0,0 +1,142 @@
+//
+//  V compiler
+//  Copyright (C) 2017  Vegard Nossum <vegard.nossum@gmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef V_ARENA_HH
+#define V_ARENA_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Memory that lives for as long as a compilation session: values, the
+// host memory backing compile-time globals, copies of types and macros
+// that we hand out pointers to, etc. Nothing is freed individually;
+// everything goes at once (destructors included) when the arena does.
+//
+// Small allocations are rounded up to a multiple of 16 bytes (which also
+// keeps everything 16-byte aligned) and carved out of big chunks; big
+// ones get a chunk of their own.
+struct arena {
+	static const size_t chunk_size = 64 * 1024;
+	static const size_t max_small_size = 1024;
+
+	struct chunk {
+		chunk *next;
+		size_t size;
+		// Data follows
+	};
+
+	struct destructor {
+		destructor *next;
+		void (*fn)(void *);
+		void *ptr;
+	};
+
+	chunk *chunks;
+	uint8_t *pos;
+	uint8_t *end;
+
+	// Run in reverse order of construction
+	destructor *destructors;
+
+	arena():
+		chunks(nullptr),
+		pos(nullptr),
+		end(nullptr),
+		destructors(nullptr)
+	{
+	}
+
+	arena(const arena &) = delete;
+	arena &operator=(const arena &) = delete;
+
+	~arena()
+	{
+		for (destructor *d = destructors; d; d = d->next)
+			d->fn(d->ptr);
+
+		chunk *next;
+		for (chunk *c = chunks; c; c = next) {
+			next = c->next;
+			free(c);
+		}
+	}
+
+	uint8_t *new_chunk(size_t size)
+	{
+		auto c = (chunk *) malloc(sizeof(chunk) + size);
+		if (!c)
+			throw std::bad_alloc();
+
+		c->size = size;
+
+		// Keep the current chunk at the front
+		if (chunks && size != chunk_size) {
+			c->next = chunks->next;
+			chunks->next = c;
+		} else {
+			c->next = chunks;
+			chunks = c;
+		}
+
+		static_assert(sizeof(chunk) % 16 == 0, "chunk data must be aligned");
+		return (uint8_t *) (c + 1);
+	}
+
+	// Everything is 16-byte aligned
+	void *alloc(size_t size)
+	{
+		if (size > max_small_size)
+			return new_chunk(size);
+
+		size = (size + 15) & ~(size_t) 15;
+
+		// Zero-sized allocations still need a valid pointer
+		if (!pos || size > (size_t) (end - pos)) {
+			pos = new_chunk(chunk_size);
+			end = pos + chunk_size;
+		}
+
+		uint8_t *result = pos;
+		pos += size;
+		return result;
+	}
+
+	template<typename T, typename... Args>
+	T *make(Args&&... args)
+	{
+		static_assert(alignof(T) <= 16, "arena can't allocate over-aligned types");
+
+		T *result = new (alloc(sizeof(T))) T(std::forward<Args>(args)...);
+
+		if (!std::is_trivially_destructible<T>::value) {
+			auto d = new (alloc(sizeof(destructor))) destructor;
+			d->next = destructors;
+			d->fn = [](void *ptr) { ((T *) ptr)->~T(); };
+			d->ptr = result;
+			destructors = d;
+		}
+
+		return result;
+	}
+};
+
+#endif
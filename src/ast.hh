@@ -21,6 +21,7 @@
 
 #include <cassert>
 #include <cctype>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -28,9 +29,15 @@
 #include <memory>
 #include <stdexcept>
 #include <sstream>
+#include <string>
 #include <vector>
 
-enum ast_node_type {
+#include <gmpxx.h>
+
+#include "str_view.hh"
+#include "symbol.hh"
+
+enum ast_node_type: uint8_t {
 	AST_UNKNOWN,
 
 	/* Atoms */
@@ -50,6 +57,12 @@ enum ast_node_type {
 	AST_SEMICOLON,
 };
 
+// The underlying type would otherwise make these print as characters
+std::ostream &operator<<(std::ostream &os, ast_node_type t)
+{
+	return os << (unsigned int) t;
+}
+
 bool is_binop(ast_node_type t)
 {
 	switch (t) {
@@ -65,102 +78,374 @@ bool is_binop(ast_node_type t)
 	return false;
 }
 
-struct ast_node;
-typedef ast_node *ast_node_ptr;
+bool is_outfix(ast_node_type t)
+{
+	switch (t) {
+	case AST_BRACKETS:
+	case AST_SQUARE_BRACKETS:
+	case AST_CURLY_BRACKETS:
+		return true;
+	default:
+		break;
+	}
+
+	return false;
+}
+
+struct ast_tree;
+
+// All trees that are currently alive, indexed by ast_tree::id. This lets
+// us refer to a node with a pair of 32-bit integers.
+static std::vector<ast_tree *> ast_trees;
 
-struct ast_node {
-	ast_node_type type;
+// Handle for a node in an ast_tree. It is the same size as a pointer so
+// that it can be passed around by value, including to and from bytecode
+// (see builtin_type_ast_node).
+struct ast_node_ptr {
+	uint32_t tree_id;
+	int32_t index;
+
+	ast_node_ptr(std::nullptr_t = nullptr):
+		tree_id(0),
+		index(-1)
+	{
+	}
+
+	ast_node_ptr(uint32_t tree_id, int32_t index):
+		tree_id(tree_id),
+		index(index)
+	{
+	}
+
+	explicit operator bool() const
+	{
+		return index != -1;
+	}
+
+	bool operator==(const ast_node_ptr &other) const
+	{
+		return tree_id == other.tree_id && index == other.index;
+	}
+
+	bool operator!=(const ast_node_ptr &other) const
+	{
+		return !(*this == other);
+	}
+
+	ast_tree &tree() const;
+
+	ast_node_type type() const;
 
 	// Position where it was defined in the source file
+	unsigned int pos() const;
+	unsigned int end() const;
+
+	// Outfix operators
+	ast_node_ptr unop() const;
+
+	// Binary operators
+	ast_node_ptr lhs() const;
+	ast_node_ptr rhs() const;
+
+	// AST_SYMBOL_NAME
+	symbol_id symbol() const;
+
+	// AST_LITERAL_INTEGER; most literals are small enough to be stored
+	// inline, the rest live in the tree's table of big integers
+	bool is_valid_integer() const;
+	bool is_small_integer() const;
+	int64_t small_integer() const;
+	const mpz_class &big_integer() const;
+
+	// AST_LITERAL_STRING; only valid for as long as the tree (and the
+	// source buffer it was parsed from) is
+	str_view string() const;
+
+	// For passing nodes to and from bytecode. This must match the
+	// in-memory representation since values of type ast_node are
+	// also loaded and stored as plain 64-bit words.
+	uint64_t to_u64() const
+	{
+		uint64_t result;
+		memcpy(&result, this, sizeof(result));
+		return result;
+	}
+
+	static ast_node_ptr from_u64(uint64_t x)
+	{
+		ast_node_ptr result;
+		memcpy((void *) &result, &x, sizeof(result));
+		return result;
+	}
+};
+
+static_assert(sizeof(ast_node_ptr) == sizeof(uint64_t),
+	"ast_node_ptr must fit in a bytecode argument");
+
+struct ast_span {
 	unsigned int pos;
 	unsigned int end;
+};
 
-	union {
-		// AST_SYMBOL_NAME for static strings only
-		// if this is nullptr, then we use pos/end to get the name
-		const char *symbol_name;
+union ast_children {
+	// Interned by the parser
+	symbol_id symbol;
 
-		unsigned int string_index;
+	// Decoded by the parser; see ast_tree::new_integer()
+	int64_t integer;
 
-		int unop;
+	// Literal contents; see ast_tree::string_at()
+	struct {
+		uint32_t offset;
+		uint32_t length;
+	} string;
 
-		struct {
-			int lhs;
-			int rhs;
-		} binop;
-	};
+	int unop;
+
+	struct {
+		int lhs;
+		int rhs;
+	} binop;
+};
+
+// Nodes are stored as a structure of arrays: tree walks (compile(), the
+// serializer, etc.) mostly only look at the type and the children, so we
+// keep those densely packed and away from the source positions.
+struct ast_tree {
+	uint32_t id;
+
+	std::vector<ast_node_type> types;
+	std::vector<ast_span> spans;
+	std::vector<ast_children> children;
 
-	ast_node():
-		type(AST_UNKNOWN)
+	// String literals without escapes point straight into the source
+	// buffer; the ones we had to decode live here instead. Both are
+	// addressed by offset (with ARENA_BIT telling them apart) so that
+	// the arena is free to grow while we're still parsing.
+	static const uint32_t ARENA_BIT = 1u << 31;
+
+	const char *source;
+	std::string string_arena;
+
+	// Integer literals that don't fit in 63 bits (signed)
+	std::vector<mpz_class> big_integers;
+
+	ast_tree():
+		source(nullptr)
 	{
+		id = ast_trees.size();
+		ast_trees.push_back(this);
 	}
 
-	ast_node(ast_node_type type, unsigned int pos, unsigned int end):
-		type(type),
-		pos(pos),
-		end(end)
+	ast_tree(const ast_tree &) = delete;
+	ast_tree &operator=(const ast_tree &) = delete;
+
+	~ast_tree()
 	{
-		if (type == AST_SYMBOL_NAME)
-			symbol_name = nullptr;
+		ast_trees[id] = nullptr;
 	}
-};
 
-struct ast_tree {
-	std::vector<ast_node> nodes;
-	std::vector<std::string> strings;
+	// Rough estimate of the number of nodes for a source file of the
+	// given size, so that we can avoid growing the arrays while parsing
+	void reserve_for_source(size_t data_size)
+	{
+		size_t nr_nodes = data_size / 4;
 
-	ast_tree()
+		types.reserve(nr_nodes);
+		spans.reserve(nr_nodes);
+		children.reserve(nr_nodes);
+	}
+
+	unsigned int size() const
 	{
+		return types.size();
 	}
 
-	template<typename... Args>
-	int new_node(Args... args)
+	int new_node(ast_node_type type, unsigned int pos, unsigned int end)
 	{
-		int result = nodes.size();
-		nodes.push_back(ast_node(args...));
+		int result = types.size();
+		types.push_back(type);
+		spans.push_back(ast_span { pos, end });
+
+		ast_children c;
+		if (type == AST_SYMBOL_NAME)
+			c.symbol = SYMBOL_NONE;
+		else
+			c.binop = { -1, -1 };
+		children.push_back(c);
+
 		return result;
 	}
 
-	unsigned int new_string(std::string s)
+	// Tagged representation of an integer literal: the lowest bit is
+	// clear for values stored inline and set for indices into
+	// big_integers. All bits set means the literal is malformed (we
+	// leave it to the compiler to complain about it).
+	static const int64_t INVALID_INTEGER = -1;
+
+	static bool fits_inline(int64_t value)
 	{
-		unsigned int result = strings.size();
-		strings.push_back(s);
-		return result;
+		return value >= INT64_MIN / 2 && value <= INT64_MAX / 2;
+	}
+
+	int64_t new_integer(int64_t value)
+	{
+		assert(fits_inline(value));
+		return (int64_t) ((uint64_t) value << 1);
+	}
+
+	int64_t new_integer(const mpz_class &value)
+	{
+		if (value.fits_slong_p() && fits_inline(value.get_si()))
+			return new_integer((int64_t) value.get_si());
+
+		int64_t index = big_integers.size();
+		big_integers.push_back(value);
+		return (index << 1) | 1;
+	}
+
+	str_view string_at(uint32_t offset, uint32_t length) const
+	{
+		if (offset & ARENA_BIT)
+			return str_view { string_arena.data() + (offset & ~ARENA_BIT), length };
+
+		return str_view { source + offset, length };
 	}
 
-	ast_node *get(int node_index)
+	ast_node_ptr get(int node_index)
 	{
 		if (node_index == -1)
 			return nullptr;
 
-		return &nodes[node_index];
+		return ast_node_ptr(id, node_index);
+	}
+
+	// Number of nodes reachable from 'root'; anything else in the tree
+	// is dead weight left behind by the parser.
+	unsigned int count_live(int root) const
+	{
+		unsigned int result = 0;
+
+		std::vector<int> stack;
+		if (root != -1)
+			stack.push_back(root);
+
+		while (!stack.empty()) {
+			int i = stack.back();
+			stack.pop_back();
+			++result;
+
+			const ast_children &c = children[i];
+			if (is_binop(types[i])) {
+				if (c.binop.lhs != -1)
+					stack.push_back(c.binop.lhs);
+				if (c.binop.rhs != -1)
+					stack.push_back(c.binop.rhs);
+			} else if (is_outfix(types[i])) {
+				if (c.unop != -1)
+					stack.push_back(c.unop);
+			}
+		}
+
+		return result;
 	}
 };
 
+inline ast_tree &ast_node_ptr::tree() const
+{
+	assert(index != -1);
+	return *ast_trees[tree_id];
+}
+
+inline ast_node_type ast_node_ptr::type() const
+{
+	return tree().types[index];
+}
+
+inline unsigned int ast_node_ptr::pos() const
+{
+	return tree().spans[index].pos;
+}
+
+inline unsigned int ast_node_ptr::end() const
+{
+	return tree().spans[index].end;
+}
+
+inline ast_node_ptr ast_node_ptr::unop() const
+{
+	return tree().get(tree().children[index].unop);
+}
+
+inline ast_node_ptr ast_node_ptr::lhs() const
+{
+	return tree().get(tree().children[index].binop.lhs);
+}
+
+inline ast_node_ptr ast_node_ptr::rhs() const
+{
+	return tree().get(tree().children[index].binop.rhs);
+}
+
+inline symbol_id ast_node_ptr::symbol() const
+{
+	assert(type() == AST_SYMBOL_NAME);
+	return tree().children[index].symbol;
+}
+
+inline bool ast_node_ptr::is_valid_integer() const
+{
+	assert(type() == AST_LITERAL_INTEGER);
+	return tree().children[index].integer != ast_tree::INVALID_INTEGER;
+}
+
+inline bool ast_node_ptr::is_small_integer() const
+{
+	assert(type() == AST_LITERAL_INTEGER);
+	return !(tree().children[index].integer & 1);
+}
+
+inline int64_t ast_node_ptr::small_integer() const
+{
+	assert(is_small_integer());
+	return tree().children[index].integer >> 1;
+}
+
+inline const mpz_class &ast_node_ptr::big_integer() const
+{
+	assert(!is_small_integer() && is_valid_integer());
+	return tree().big_integers[tree().children[index].integer >> 1];
+}
+
+inline str_view ast_node_ptr::string() const
+{
+	assert(type() == AST_LITERAL_STRING);
+	const auto &s = tree().children[index].string;
+	return tree().string_at(s.offset, s.length);
+}
+
 template<ast_node_type type>
 struct traverse {
 	struct iterator {
-		ast_tree &tree;
 		ast_node_ptr node;
 
-		iterator(ast_tree &tree, ast_node_ptr node):
-			tree(tree),
+		iterator(ast_node_ptr node):
 			node(node)
 		{
 		}
 
 		ast_node_ptr operator*()
 		{
-			if (node->type == type)
-				return tree.get(node->binop.lhs);
+			if (node.type() == type)
+				return node.lhs();
 
 			return node;
 		}
 
 		iterator &operator++()
 		{
-			if (node->type == type)
-				node = tree.get(node->binop.rhs);
+			if (node.type() == type)
+				node = node.rhs();
 			else
 				node = nullptr;
 
@@ -169,28 +454,25 @@ struct traverse {
 
 		bool operator!=(const iterator &other) const
 		{
-			assert(&tree == &other.tree);
 			return node != other.node;
 		}
 	};
 
-	ast_tree &tree;
 	ast_node_ptr node;
 
-	traverse(ast_tree &tree, ast_node_ptr node):
-		tree(tree),
+	traverse(ast_node_ptr node):
 		node(node)
 	{
 	}
 
 	iterator begin()
 	{
-		return iterator(tree, node);
+		return iterator(node);
 	}
 
 	iterator end()
 	{
-		return iterator(tree, nullptr);
+		return iterator(nullptr);
 	}
 };
 
@@ -0,0 +1,405 @@
+//
+//  V compiler
+//  Copyright (C) 2017  Vegard Nossum <vegard.nossum@gmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef V_AST_CACHE_HH
+#define V_AST_CACHE_HH
+
+extern "C" {
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ast.hh"
+#include "format.hh"
+#include "symbol.hh"
+
+// Parsed ASTs can be cached on disk (see --ast-cache=DIR). Cache files
+// are named after a hash of the source, so editing a file simply means
+// we look for a different cache file; there is nothing to invalidate.
+//
+// The file is a header followed by the node arrays exactly as they are
+// laid out in ast_tree, so loading one is mostly a matter of mapping it
+// and copying. Everything is addressed by index/offset. The exceptions
+// are symbol IDs, which are only meaningful within one process: the file
+// has its own symbol numbering and a list of names which we intern (and
+// remap the nodes to) when loading.
+
+static const char ast_cache_magic[4] = { 'V', 'A', 'S', 'T' };
+
+// Bump this whenever the layout of the file or of the AST changes
+static const uint32_t ast_cache_version = 1;
+
+struct ast_cache_header {
+	char magic[4];
+	uint32_t version;
+
+	uint64_t source_hash;
+	uint64_t source_size;
+
+	int32_t root;
+	uint32_t nr_nodes;
+
+	// Names are stored back to back, each followed by a NUL byte
+	uint32_t nr_symbols;
+	uint32_t symbols_size;
+
+	uint32_t string_arena_size;
+
+	// In hex, each followed by a NUL byte
+	uint32_t nr_big_integers;
+	uint32_t big_integers_size;
+};
+
+// Not cryptographic; we also check the size, and a cache directory is not
+// meant to be shared with people you don't trust anyway.
+static uint64_t ast_cache_hash(const char *data, size_t size)
+{
+	const uint64_t k = 0x9e3779b97f4a7c15ull;
+
+	uint64_t result = size * k;
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, &data[i], sizeof(word));
+
+		result = (result ^ word) * k;
+		result ^= result >> 32;
+	}
+
+	for (; i < size; ++i) {
+		result = (result ^ (unsigned char) data[i]) * k;
+		result ^= result >> 32;
+	}
+
+	return result;
+}
+
+static std::string ast_cache_filename(const char *dir, uint64_t hash)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016lx.vast", (unsigned long) hash);
+	return format("$/$", dir, name);
+}
+
+// Each section starts at an 8-byte aligned offset
+static size_t ast_cache_align(size_t offset)
+{
+	return (offset + 7) & ~(size_t) 7;
+}
+
+struct ast_cache_layout {
+	size_t types;
+	size_t spans;
+	size_t children;
+	size_t symbols;
+	size_t string_arena;
+	size_t big_integers;
+	size_t size;
+
+	ast_cache_layout(const ast_cache_header &header)
+	{
+		types = ast_cache_align(sizeof(header));
+		spans = ast_cache_align(types + header.nr_nodes * sizeof(ast_node_type));
+		children = ast_cache_align(spans + header.nr_nodes * sizeof(ast_span));
+		symbols = ast_cache_align(children + header.nr_nodes * sizeof(ast_children));
+		string_arena = ast_cache_align(symbols + header.symbols_size);
+		big_integers = ast_cache_align(string_arena + header.string_arena_size);
+		size = big_integers + header.big_integers_size;
+	}
+};
+
+// The file is only as trustworthy as the cache directory, so check that
+// everything we copied out of it is in range before anybody follows it.
+static bool ast_cache_check_nodes(const ast_tree &tree, size_t data_size, int root)
+{
+	int nr_nodes = tree.size();
+
+	if (root < -1 || root >= nr_nodes)
+		return false;
+
+	for (int i = 0; i < nr_nodes; ++i) {
+		ast_node_type type = tree.types[i];
+		if (type > AST_SEMICOLON)
+			return false;
+
+		const ast_span &span = tree.spans[i];
+		if (span.pos > span.end || span.end > data_size)
+			return false;
+
+		// The parser always creates children before their parent,
+		// which also means there can't be any cycles
+		const ast_children &c = tree.children[i];
+		if (is_binop(type)) {
+			if (c.binop.lhs < -1 || c.binop.lhs >= i)
+				return false;
+			if (c.binop.rhs < -1 || c.binop.rhs >= i)
+				return false;
+		} else if (is_outfix(type)) {
+			if (c.unop < -1 || c.unop >= i)
+				return false;
+		} else if (type == AST_LITERAL_STRING) {
+			size_t offset = c.string.offset;
+			size_t limit = data_size;
+			if (offset & ast_tree::ARENA_BIT) {
+				offset &= ~ast_tree::ARENA_BIT;
+				limit = tree.string_arena.size();
+			}
+
+			if (offset > limit || c.string.length > limit - offset)
+				return false;
+		} else if (type == AST_LITERAL_INTEGER) {
+			int64_t integer = c.integer;
+			if (integer != ast_tree::INVALID_INTEGER && (integer & 1)) {
+				if (integer < 0 || (uint64_t) (integer >> 1) >= tree.big_integers.size())
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Returns false if there is no usable cache file, in which case the
+// caller should just parse the source.
+static bool load_ast_cache(const char *dir, const char *data, size_t data_size, ast_tree &tree, int &root)
+{
+	uint64_t hash = ast_cache_hash(data, data_size);
+	std::string filename = ast_cache_filename(dir, hash);
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat stbuf;
+	if (fstat(fd, &stbuf) == -1 || (size_t) stbuf.st_size < sizeof(ast_cache_header)) {
+		close(fd);
+		return false;
+	}
+
+	void *mem = mmap(nullptr, stbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		return false;
+
+	const char *buf = (const char *) mem;
+	size_t size = stbuf.st_size;
+
+	bool ok = false;
+	do {
+		ast_cache_header header;
+		memcpy(&header, buf, sizeof(header));
+
+		if (memcmp(header.magic, ast_cache_magic, sizeof(ast_cache_magic)))
+			break;
+		if (header.version != ast_cache_version)
+			break;
+		if (header.source_hash != hash || header.source_size != data_size)
+			break;
+
+		ast_cache_layout layout(header);
+		if (layout.size != size)
+			break;
+
+		// Intern the file's symbols; the node arrays refer to them
+		// by their position in this list
+		std::vector<symbol_id> symbol_map;
+		symbol_map.reserve(header.nr_symbols);
+
+		const char *names = buf + layout.symbols;
+		const char *names_end = names + header.symbols_size;
+		while (names < names_end) {
+			size_t len = strnlen(names, names_end - names);
+			if (names + len == names_end)
+				break;
+
+			symbol_map.push_back(symbols.intern(names, len));
+			names += len + 1;
+		}
+
+		if (symbol_map.size() != header.nr_symbols)
+			break;
+
+		unsigned int nr_nodes = header.nr_nodes;
+		auto types = (const ast_node_type *) (buf + layout.types);
+		auto spans = (const ast_span *) (buf + layout.spans);
+		auto children = (const ast_children *) (buf + layout.children);
+
+		tree.types.assign(types, types + nr_nodes);
+		tree.spans.assign(spans, spans + nr_nodes);
+		tree.children.assign(children, children + nr_nodes);
+
+		bool bad_symbol = false;
+		for (unsigned int i = 0; i < nr_nodes; ++i) {
+			if (tree.types[i] != AST_SYMBOL_NAME)
+				continue;
+
+			symbol_id &symbol = tree.children[i].symbol;
+			if (symbol >= symbol_map.size()) {
+				bad_symbol = true;
+				break;
+			}
+
+			symbol = symbol_map[symbol];
+		}
+
+		if (bad_symbol)
+			break;
+
+		tree.source = data;
+		tree.string_arena.assign(buf + layout.string_arena, header.string_arena_size);
+
+		tree.big_integers.clear();
+		const char *big = buf + layout.big_integers;
+		const char *big_end = big + header.big_integers_size;
+		while (big < big_end) {
+			size_t len = strnlen(big, big_end - big);
+			if (big + len == big_end)
+				break;
+
+			// The constructor throws on anything that isn't a number
+			mpz_class x;
+			if (x.set_str(std::string(big, len), 16))
+				break;
+
+			tree.big_integers.push_back(x);
+			big += len + 1;
+		}
+
+		if (tree.big_integers.size() != header.nr_big_integers)
+			break;
+
+		if (!ast_cache_check_nodes(tree, data_size, header.root))
+			break;
+
+		root = header.root;
+		ok = true;
+	} while (0);
+
+	munmap(mem, size);
+
+	if (!ok) {
+		// Don't leave a half-loaded tree behind
+		tree.types.clear();
+		tree.spans.clear();
+		tree.children.clear();
+		tree.string_arena.clear();
+		tree.big_integers.clear();
+	}
+
+	return ok;
+}
+
+// Failing to write the cache is not an error; we'll just parse the
+// source again next time.
+static void save_ast_cache(const char *dir, const char *data, size_t data_size, const ast_tree &tree, int root)
+{
+	// Zeroed so that we don't write out uninitialised padding
+	ast_cache_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ast_cache_magic, sizeof(header.magic));
+	header.version = ast_cache_version;
+	header.source_hash = ast_cache_hash(data, data_size);
+	header.source_size = data_size;
+	header.root = root;
+	header.nr_nodes = tree.size();
+
+	// Renumber the symbols in the order they first appear
+	std::vector<ast_children> children(tree.children);
+
+	std::vector<uint32_t> symbol_map(symbols.size(), UINT32_MAX);
+	std::string names;
+	header.nr_symbols = 0;
+
+	for (unsigned int i = 0; i < header.nr_nodes; ++i) {
+		if (tree.types[i] != AST_SYMBOL_NAME)
+			continue;
+
+		symbol_id symbol = children[i].symbol;
+		if (symbol_map[symbol] == UINT32_MAX) {
+			symbol_map[symbol] = header.nr_symbols++;
+			names += symbols.name(symbol);
+			names.push_back('\0');
+		}
+
+		// The rest of the union is never written for symbol names
+		memset(&children[i], 0, sizeof(children[i]));
+		children[i].symbol = symbol_map[symbol];
+	}
+
+	header.symbols_size = names.size();
+	header.string_arena_size = tree.string_arena.size();
+
+	std::string big_integers;
+	for (const mpz_class &x: tree.big_integers) {
+		big_integers += x.get_str(16);
+		big_integers.push_back('\0');
+	}
+
+	header.nr_big_integers = tree.big_integers.size();
+	header.big_integers_size = big_integers.size();
+
+	ast_cache_layout layout(header);
+
+	std::vector<char> buf(layout.size);
+	memcpy(buf.data(), &header, sizeof(header));
+	memcpy(buf.data() + layout.types, tree.types.data(), header.nr_nodes * sizeof(ast_node_type));
+	memcpy(buf.data() + layout.spans, tree.spans.data(), header.nr_nodes * sizeof(ast_span));
+	memcpy(buf.data() + layout.children, children.data(), header.nr_nodes * sizeof(ast_children));
+	memcpy(buf.data() + layout.symbols, names.data(), names.size());
+	memcpy(buf.data() + layout.string_arena, tree.string_arena.data(), tree.string_arena.size());
+	memcpy(buf.data() + layout.big_integers, big_integers.data(), big_integers.size());
+
+	mkdir(dir, 0777);
+
+	// Write to a temporary file first so that nobody ever sees a
+	// partially written cache file
+	std::string filename = ast_cache_filename(dir, header.source_hash);
+	std::string tmp_filename = format("$.XXXXXX", filename);
+
+	int fd = mkstemp(&tmp_filename[0]);
+	if (fd == -1)
+		return;
+
+	FILE *f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		unlink(tmp_filename.c_str());
+		return;
+	}
+
+	bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+	if (fclose(f))
+		ok = false;
+
+	if (!ok || rename(tmp_filename.c_str(), filename.c_str()))
+		unlink(tmp_filename.c_str());
+}
+
+#endif
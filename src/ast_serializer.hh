@@ -21,19 +21,123 @@
 
 #include <cassert>
 #include <cctype>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <iostream>
-#include <iterator>
 #include <memory>
 #include <stdexcept>
-#include <sstream>
 #include <string>
 #include <vector>
 
 #include "ast.hh"
 #include "source_file.hh"
 
+// Where the serializers write their output: a fixed-size buffer that is
+// flushed to a FILE (or appended to a string) whenever it fills up, so we
+// never hold more than that of a dump in memory.
+struct ast_output {
+	FILE *file;
+	std::string *str;
+
+	size_t len;
+	char buf[64 * 1024];
+
+	ast_output(FILE *file):
+		file(file),
+		str(nullptr),
+		len(0)
+	{
+	}
+
+	ast_output(std::string &str):
+		file(nullptr),
+		str(&str),
+		len(0)
+	{
+	}
+
+	ast_output(const ast_output &) = delete;
+	ast_output &operator=(const ast_output &) = delete;
+
+	~ast_output()
+	{
+		flush();
+	}
+
+	void flush()
+	{
+		if (file)
+			fwrite(buf, 1, len, file);
+		else
+			str->append(buf, len);
+
+		len = 0;
+	}
+
+	void write(const char *s, size_t n)
+	{
+		if (len + n > sizeof(buf)) {
+			flush();
+
+			// Too big to be worth buffering
+			if (n > sizeof(buf)) {
+				if (file)
+					fwrite(s, 1, n, file);
+				else
+					str->append(s, n);
+				return;
+			}
+		}
+
+		memcpy(buf + len, s, n);
+		len += n;
+	}
+
+	ast_output &operator<<(char c)
+	{
+		if (len == sizeof(buf))
+			flush();
+
+		buf[len++] = c;
+		return *this;
+	}
+
+	ast_output &operator<<(const char *s)
+	{
+		write(s, strlen(s));
+		return *this;
+	}
+
+	ast_output &operator<<(const std::string &s)
+	{
+		write(s.data(), s.size());
+		return *this;
+	}
+
+	ast_output &operator<<(str_view s)
+	{
+		write(s.data, s.length);
+		return *this;
+	}
+
+	ast_output &operator<<(unsigned int x)
+	{
+		char tmp[16];
+		write(tmp, snprintf(tmp, sizeof(tmp), "%u", x));
+		return *this;
+	}
+
+	void spaces(unsigned int n)
+	{
+		static const char space[] = "                                                                ";
+		const unsigned int chunk = sizeof(space) - 1;
+
+		for (; n > chunk; n -= chunk)
+			write(space, chunk);
+		write(space, n);
+	}
+};
+
 struct ast_serializer {
 	source_file_ptr source;
 	unsigned int max_depth;
@@ -48,22 +152,27 @@ struct ast_serializer {
 	{
 	}
 
-	void line_break(std::ostream &os, const char *space = " ")
+	void line_break(ast_output &os, const char *space = " ")
 	{
 		if (line_breaks)
-			os << "\n";
+			os << '\n';
 		else
 			os << space;
 	}
 
-	void indent(std::ostream &os, unsigned int depth)
+	void indent(ast_output &os, unsigned int depth)
+	{
+		os.spaces(depth * indentation);
+	}
+
+	str_view source_for(const ast_node_ptr node)
 	{
-		std::fill_n(std::ostream_iterator<char>(os), depth * indentation, ' ');
+		return str_view { &source->data[node.pos()], node.end() - node.pos() };
 	}
 
-	void unop(std::ostream &os, const ast_node_ptr node, unsigned int depth, const char *name)
+	void unop(ast_output &os, const ast_node_ptr node, unsigned int depth, const char *name)
 	{
-		auto child = source->tree.get(node->unop);
+		auto child = node.unop();
 
 		if (child) {
 			indent(os, depth);
@@ -79,45 +188,78 @@ struct ast_serializer {
 		}
 	}
 
-	void binop(std::ostream &os, const ast_node_ptr node, unsigned int depth, const char *name)
+	// Binary operators are serialized in a loop along the right hand side
+	// so that long lists don't recurse; 'nr_open' counts the parentheses
+	// we need to close again at the end.
+	void binop(ast_output &os, ast_node_ptr &node, unsigned int &depth, unsigned int &nr_open, const char *name)
 	{
 		indent(os, depth);
 		os << "(" << name;
 		line_break(os);
-		serialize(os, source->tree.get(node->binop.lhs), depth + 1);
+		serialize(os, node.lhs(), depth + 1);
 		line_break(os);
-		serialize(os, source->tree.get(node->binop.rhs), depth + 1);
-		line_break(os, "");
-		indent(os, depth);
-		os << ")";
+
+		node = node.rhs();
+		++depth;
+		++nr_open;
+	}
+
+	void serialize(ast_output &os, ast_node_ptr node, unsigned int depth = 0)
+	{
+		unsigned int nr_open = 0;
+
+		while (node && is_binop(node.type()) && !(max_depth && depth >= max_depth)) {
+			switch (node.type()) {
+			case AST_MEMBER:
+				binop(os, node, depth, nr_open, "member");
+				break;
+			case AST_JUXTAPOSE:
+				binop(os, node, depth, nr_open, "juxtapose");
+				break;
+			case AST_COMMA:
+				binop(os, node, depth, nr_open, "comma");
+				break;
+			case AST_SEMICOLON:
+				binop(os, node, depth, nr_open, "semicolon");
+				break;
+			default:
+				assert(false);
+			}
+		}
+
+		serialize_leaf(os, node, depth);
+
+		while (nr_open--) {
+			--depth;
+			line_break(os, "");
+			indent(os, depth);
+			os << ")";
+		}
 	}
 
-	void serialize(std::ostream &os, const ast_node_ptr node, unsigned int depth = 0)
+	void serialize_leaf(ast_output &os, const ast_node_ptr node, unsigned int depth)
 	{
 		if (max_depth && depth >= max_depth) {
 			os << "...";
 			return;
 		}
 
-		switch (node->type) {
+		switch (node.type()) {
 		case AST_UNKNOWN:
 			os << "(unknown)";
 			break;
 
 		case AST_LITERAL_INTEGER:
 			indent(os, depth);
-			os << "(literal_integer " << std::string(&source->data[node->pos], node->end - node->pos) << ")";
+			os << "(literal_integer " << source_for(node) << ")";
 			break;
 		case AST_LITERAL_STRING:
 			indent(os, depth);
-			os << "(literal_string " << std::string(&source->data[node->pos], node->end - node->pos) << ")";
+			os << "(literal_string " << source_for(node) << ")";
 			break;
 		case AST_SYMBOL_NAME:
 			indent(os, depth);
-			if (node->symbol_name)
-				os << "(symbol_name " << node->symbol_name << ")";
-			else
-				os << "(symbol_name " << std::string(&source->data[node->pos], node->end - node->pos) << ")";
+			os << "(symbol_name " << symbols.name(node.symbol()) << ")";
 			break;
 
 		case AST_BRACKETS:
@@ -130,29 +272,29 @@ struct ast_serializer {
 			unop(os, node, depth, "curly-brackets");
 			break;
 
-		case AST_MEMBER:
-			binop(os, node, depth, "member");
-			break;
-		case AST_JUXTAPOSE:
-			binop(os, node, depth, "juxtapose");
-			break;
-		case AST_COMMA:
-			binop(os, node, depth, "comma");
-			break;
-		case AST_SEMICOLON:
-			binop(os, node, depth, "semicolon");
-			break;
+		default:
+			assert(false);
 		}
 	}
 };
 
 std::string serialize(const source_file_ptr source, const ast_node_ptr node)
 {
-	ast_serializer s(source);
+	std::string result;
+	{
+		ast_output os(result);
+		ast_serializer(source).serialize(os, node);
+	}
 
-	std::ostringstream ss;
-	s.serialize(ss, node);
-	return ss.str();
+	return result;
+}
+
+// Stream the serialized AST to 'f' without building it in memory first
+void serialize(FILE *f, const source_file_ptr source, const ast_node_ptr node)
+{
+	ast_output os(f);
+	ast_serializer(source).serialize(os, node);
+	os << '\n';
 }
 
 // Create a "one-line" abbreviation of the serialized AST node, useful
@@ -165,9 +307,130 @@ std::string abbreviate(const source_file_ptr source, const ast_node_ptr node)
 	s.indentation = 0;
 	s.line_breaks = false;
 
-	std::ostringstream ss;
-	s.serialize(ss, node);
-	return ss.str();
+	std::string result;
+	{
+		ast_output os(result);
+		s.serialize(os, node);
+	}
+
+	return result;
+}
+
+static void json_string(ast_output &os, const char *s, size_t len)
+{
+	os << '"';
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char c = s[i];
+		switch (c) {
+		case '"':
+			os << "\\\"";
+			break;
+		case '\\':
+			os << "\\\\";
+			break;
+		case '\n':
+			os << "\\n";
+			break;
+		case '\t':
+			os << "\\t";
+			break;
+		default:
+			if (c < 0x20) {
+				char tmp[8];
+				snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+				os << tmp;
+			} else {
+				os << (char) c;
+			}
+			break;
+		}
+	}
+	os << '"';
+}
+
+static void json_node_id(ast_output &os, const ast_node_ptr node)
+{
+	if (node)
+		os << (unsigned int) node.index;
+	else
+		os << "null";
+}
+
+// The same tree as one JSON object per line, for tools that want to
+// read big ASTs without parsing the s-expressions above. Nodes are
+// written parents first, and refer to their children by "id" (which is
+// the node's index in the tree):
+//
+//   {"id":2,"type":"juxtapose","pos":0,"end":10,"lhs":0,"rhs":1}
+//   {"id":0,"type":"symbol_name","pos":0,"end":5,"name":"print"}
+//   {"id":1,"type":"literal_integer","pos":6,"end":9,"text":"123"}
+void serialize_jsonl(FILE *f, const source_file_ptr source, const ast_node_ptr root)
+{
+	static const char *type_names[] = {
+		"unknown",
+		"literal_integer",
+		"literal_string",
+		"symbol_name",
+		"brackets",
+		"square-brackets",
+		"curly-brackets",
+		"member",
+		"juxtapose",
+		"comma",
+		"semicolon",
+	};
+
+	ast_output os(f);
+
+	std::vector<ast_node_ptr> stack;
+	if (root)
+		stack.push_back(root);
+
+	while (!stack.empty()) {
+		ast_node_ptr node = stack.back();
+		stack.pop_back();
+
+		auto type = node.type();
+		assert(type < sizeof(type_names) / sizeof(*type_names));
+
+		os << "{\"id\":" << (unsigned int) node.index
+			<< ",\"type\":\"" << type_names[type]
+			<< "\",\"pos\":" << node.pos()
+			<< ",\"end\":" << node.end();
+
+		if (is_binop(type)) {
+			auto lhs = node.lhs();
+			auto rhs = node.rhs();
+
+			os << ",\"lhs\":";
+			json_node_id(os, lhs);
+			os << ",\"rhs\":";
+			json_node_id(os, rhs);
+
+			// Pushed in reverse so that lhs comes out first
+			if (rhs)
+				stack.push_back(rhs);
+			if (lhs)
+				stack.push_back(lhs);
+		} else if (is_outfix(type)) {
+			auto child = node.unop();
+
+			os << ",\"child\":";
+			json_node_id(os, child);
+
+			if (child)
+				stack.push_back(child);
+		} else if (type == AST_SYMBOL_NAME) {
+			const std::string &name = symbols.name(node.symbol());
+			os << ",\"name\":";
+			json_string(os, name.data(), name.size());
+		} else if (type == AST_LITERAL_INTEGER || type == AST_LITERAL_STRING) {
+			os << ",\"text\":";
+			json_string(os, &source->data[node.pos()], node.end() - node.pos());
+		}
+
+		os << "}\n";
+	}
 }
 
 #endif
@@ -43,7 +43,7 @@ static auto builtin_type_scope = std::make_shared<value_type>(value_type {
 	.constructor = nullptr,
 	.argument_types = std::vector<value_type_ptr>(),
 	.return_type = nullptr,
-	.members = std::map<std::string, member_ptr>({
+	.members = member_table({
 	}),
 });
 
@@ -47,20 +47,20 @@ struct asm_assign_input_macro: macro {
 		// these can be moved to a register without using any
 		// other register.
 
-		if (node->type != AST_JUXTAPOSE)
+		if (node.type() != AST_JUXTAPOSE)
 			error(node, "expected juxtaposition");
 
-		auto src_node = state->source->tree.get(node->binop.rhs);
+		auto src_node = node.rhs();
 		auto src_value = compile(src_node);
 
-		auto dest_node = state->source->tree.get(node->binop.lhs);
+		auto dest_node = node.lhs();
 		auto dest_value = eval(dest_node);
 		if (dest_value->type != builtin_type_asm_register)
 			error(dest_node, "expected register");
 		if (dest_value->storage_type != VALUE_GLOBAL)
 			error(dest_node, "expected compile-time constant");
 
-		auto f = std::dynamic_pointer_cast<x86_64_function>(state->function);
+		auto f = dynamic_ref_cast<x86_64_function>(state->function);
 		if (!f)
 			error(node, "x86_64 inline asm used in non-x86_64 function");
 
@@ -89,30 +89,30 @@ struct asm_assign_output_macro: macro {
 struct asm_mov_macro: macro {
 	value_ptr invoke(ast_node_ptr node)
 	{
-		if (node->type != AST_BRACKETS)
+		if (node.type() != AST_BRACKETS)
 			error(node, "expected (reg, reg)");
 
-		auto unop = state->source->tree.get(node->unop);
-		if (unop->type != AST_COMMA)
+		auto unop = node.unop();
+		if (unop.type() != AST_COMMA)
 			error(node, "expected (reg, reg)");
 
 		node = unop;
 
-		auto src_node = state->source->tree.get(node->binop.lhs);
+		auto src_node = node.lhs();
 		auto src_value = eval(src_node);
 		if (src_value->type != builtin_type_asm_register)
 			error(src_node, "expected register");
 		if (src_value->storage_type != VALUE_GLOBAL)
 			error(src_node, "expected compile-time constant");
 
-		auto dest_node = state->source->tree.get(node->binop.rhs);
+		auto dest_node = node.rhs();
 		auto dest_value = eval(dest_node);
 		if (dest_value->type != builtin_type_asm_register)
 			error(dest_node, "expected register");
 		if (dest_value->storage_type != VALUE_GLOBAL)
 			error(dest_node, "expected compile-time constant");
 
-		auto f = std::dynamic_pointer_cast<x86_64_function>(state->function);
+		auto f = dynamic_ref_cast<x86_64_function>(state->function);
 		if (!f)
 			error(node, "x86_64 inline asm used in non-x86_64 function");
 
@@ -125,10 +125,10 @@ struct asm_mov_macro: macro {
 struct asm_syscall_macro: macro {
 	value_ptr invoke(ast_node_ptr node)
 	{
-		if (node->type != AST_BRACKETS || state->source->tree.get(node->unop))
+		if (node.type() != AST_BRACKETS || node.unop())
 			error(node, "expected ()");
 
-		auto f = std::dynamic_pointer_cast<x86_64_function>(state->function);
+		auto f = dynamic_ref_cast<x86_64_function>(state->function);
 		if (!f)
 			error(node, "x86_64 inline asm used in non-x86_64 function");
 
@@ -140,54 +140,54 @@ struct asm_syscall_macro: macro {
 
 static value_ptr builtin_macro_asm(ast_node_ptr node)
 {
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected juxtaposition");
 
-	auto inputs_node = state->source->tree.get(node->binop.lhs);
-	node = state->source->tree.get(node->binop.rhs);
+	auto inputs_node = node.lhs();
+	node = node.rhs();
 
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected juxtaposition");
 
-	auto outputs_node = state->source->tree.get(node->binop.lhs);
-	auto asm_node = state->source->tree.get(node->binop.rhs);
+	auto outputs_node = node.lhs();
+	auto asm_node = node.rhs();
 
-	auto new_scope = std::make_shared<scope>(state->scope);
+	scope_frame new_scope(state->scope);
 
 	// registers
-	new_scope->define_builtin_constant("rax", builtin_type_asm_register, RAX);
-	new_scope->define_builtin_constant("rcx", builtin_type_asm_register, RCX);
-	new_scope->define_builtin_constant("rdx", builtin_type_asm_register, RDX);
-	new_scope->define_builtin_constant("rbx", builtin_type_asm_register, RBX);
-	new_scope->define_builtin_constant("rsp", builtin_type_asm_register, RSP);
-	new_scope->define_builtin_constant("rbp", builtin_type_asm_register, RBP);
-	new_scope->define_builtin_constant("rsi", builtin_type_asm_register, RSI);
-	new_scope->define_builtin_constant("rdi", builtin_type_asm_register, RDI);
-	new_scope->define_builtin_constant("r8", builtin_type_asm_register, R8);
-	new_scope->define_builtin_constant("r9", builtin_type_asm_register, R9);
-	new_scope->define_builtin_constant("r10", builtin_type_asm_register, R10);
-	new_scope->define_builtin_constant("r11", builtin_type_asm_register, R11);
-	new_scope->define_builtin_constant("r12", builtin_type_asm_register, R12);
-	new_scope->define_builtin_constant("r13", builtin_type_asm_register, R13);
-	new_scope->define_builtin_constant("r14", builtin_type_asm_register, R14);
-	new_scope->define_builtin_constant("r15", builtin_type_asm_register, R15);
-
-	auto inputs_scope = std::make_shared<scope>(new_scope);
-	inputs_scope->define_builtin_macro("_assign", std::make_shared<asm_assign_input_macro>());
-	(use_scope(inputs_scope), compile(inputs_node));
-
-	auto outputs_scope = std::make_shared<scope>(new_scope);
-	outputs_scope->define_builtin_macro("_assign", std::make_shared<asm_assign_output_macro>());
-	(use_scope(outputs_scope), compile(outputs_node));
+	new_scope.define_builtin_constant("rax", builtin_type_asm_register, RAX);
+	new_scope.define_builtin_constant("rcx", builtin_type_asm_register, RCX);
+	new_scope.define_builtin_constant("rdx", builtin_type_asm_register, RDX);
+	new_scope.define_builtin_constant("rbx", builtin_type_asm_register, RBX);
+	new_scope.define_builtin_constant("rsp", builtin_type_asm_register, RSP);
+	new_scope.define_builtin_constant("rbp", builtin_type_asm_register, RBP);
+	new_scope.define_builtin_constant("rsi", builtin_type_asm_register, RSI);
+	new_scope.define_builtin_constant("rdi", builtin_type_asm_register, RDI);
+	new_scope.define_builtin_constant("r8", builtin_type_asm_register, R8);
+	new_scope.define_builtin_constant("r9", builtin_type_asm_register, R9);
+	new_scope.define_builtin_constant("r10", builtin_type_asm_register, R10);
+	new_scope.define_builtin_constant("r11", builtin_type_asm_register, R11);
+	new_scope.define_builtin_constant("r12", builtin_type_asm_register, R12);
+	new_scope.define_builtin_constant("r13", builtin_type_asm_register, R13);
+	new_scope.define_builtin_constant("r14", builtin_type_asm_register, R14);
+	new_scope.define_builtin_constant("r15", builtin_type_asm_register, R15);
+
+	scope_frame inputs_scope(new_scope.ptr());
+	inputs_scope.define_builtin_macro("_assign", std::make_shared<asm_assign_input_macro>());
+	(use_scope(inputs_scope.ptr()), compile(inputs_node));
+
+	scope_frame outputs_scope(new_scope.ptr());
+	outputs_scope.define_builtin_macro("_assign", std::make_shared<asm_assign_output_macro>());
+	(use_scope(outputs_scope.ptr()), compile(outputs_node));
 
 	// TODO: this is architecture-specific for now
-	auto asm_scope = std::make_shared<scope>(new_scope);
+	scope_frame asm_scope(new_scope.ptr());
 
 	// instructions
-	asm_scope->define_builtin_macro("mov", std::make_shared<asm_mov_macro>());
-	asm_scope->define_builtin_macro("syscall", std::make_shared<asm_syscall_macro>());
+	asm_scope.define_builtin_macro("mov", std::make_shared<asm_mov_macro>());
+	asm_scope.define_builtin_macro("syscall", std::make_shared<asm_syscall_macro>());
 
-	(use_scope(asm_scope), compile(asm_node));
+	(use_scope(asm_scope.ptr()), compile(asm_node));
 
 	return &builtin_value_void;
 }
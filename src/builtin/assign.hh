@@ -27,11 +27,11 @@
 
 static value_ptr builtin_macro_assign(ast_node_ptr node)
 {
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected juxtaposition");
 
-	auto rhs = compile(get_node(node->binop.rhs));
-	auto lhs = compile(get_node(node->binop.lhs));
+	auto rhs = compile(node.rhs());
+	auto lhs = compile(node.lhs());
 	if (rhs->type != lhs->type)
 		error(node, "type mismatch");
 
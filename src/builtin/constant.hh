@@ -26,26 +26,26 @@
 #include "value.hh"
 
 struct constant_define_macro: macro {
-	scope_ptr s;
+	borrowed_scope_ptr s;
 
-	constant_define_macro(scope_ptr s):
-		s(s)
+	constant_define_macro(const scope_ptr &s):
+		s(s.get())
 	{
 	}
 
 	value_ptr invoke(ast_node_ptr node)
 	{
-		if (node->type != AST_JUXTAPOSE)
+		if (node.type() != AST_JUXTAPOSE)
 			error(node, "expected juxtaposition");
 
-		auto lhs = get_node(node->binop.lhs);
-		if (lhs->type != AST_SYMBOL_NAME)
+		auto lhs = node.lhs();
+		if (lhs.type() != AST_SYMBOL_NAME)
 			error(node, "definition of non-symbol");
 
-		auto symbol_name = get_symbol_name(lhs);
+		auto symbol = get_symbol(lhs);
 
 		// TODO: We shouldn't be generating any code -- it must be a compile-time constant expression.
-		auto rhs = (use_scope(s), compile(get_node(node->binop.rhs)));
+		auto rhs = (use_scope(scope_ptr(s)), compile(node.rhs()));
 		assert(rhs->type->size == 8);
 
 		auto val = s->make_value(state->context, VALUE_CONSTANT, rhs->type);
@@ -69,7 +69,7 @@ struct constant_define_macro: macro {
 			assert(false);
 		}
 
-		s->define(state->function, state->source, node, symbol_name, val);
+		s->define(state->function, state->source, node, symbol, val);
 		return &builtin_value_void;
 	}
 };
@@ -77,10 +77,10 @@ struct constant_define_macro: macro {
 static value_ptr builtin_macro_constant(ast_node_ptr node)
 {
 	auto old_scope = state->scope;
-	auto new_scope = std::make_shared<scope>(state->scope);
-	new_scope->define_builtin_macro("_define", std::make_shared<constant_define_macro>(old_scope));
+	scope_frame new_scope(state->scope);
+	new_scope.define_builtin_macro("_define", std::make_shared<constant_define_macro>(old_scope));
 
-	return (use_scope(new_scope), compile(node));
+	return (use_scope(new_scope.ptr()), compile(node));
 }
 
 #endif
@@ -27,17 +27,17 @@
 
 static value_ptr builtin_macro_declare(ast_node_ptr node)
 {
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected juxtaposition");
 
-	auto lhs = get_node(node->binop.lhs);
-	if (lhs->type != AST_SYMBOL_NAME)
+	auto lhs = node.lhs();
+	if (lhs.type() != AST_SYMBOL_NAME)
 		error(node, "declaration of non-symbol");
 
-	auto symbol_name = get_symbol_name(lhs);
+	auto symbol = get_symbol(lhs);
 
 	// see builtin_macro_define
-	auto rhs_node = get_node(node->binop.rhs);
+	auto rhs_node = node.rhs();
 	auto rhs = eval(rhs_node);
 	if (rhs->storage_type != VALUE_GLOBAL)
 		error(rhs_node, "type must be known at compile time");
@@ -49,10 +49,9 @@ static value_ptr builtin_macro_declare(ast_node_ptr node)
 	// a new global value. The _name_ is still scoped as usual,
 	// though.
 	auto val = state->scope->make_value(state->context, VALUE_GLOBAL, rhs_type);
-	auto global = new uint8_t[rhs_type->size];
-	val->global.host_address = (void *) global;
+	val->global.host_address = state->scope->alloc_global(rhs_type);
 
-	state->scope->define(state->function, state->source, node, symbol_name, val);
+	state->scope->define(state->function, state->source, node, symbol, val);
 	return val;
 }
 
@@ -28,24 +28,23 @@
 // _define at the top-level, creates globals
 static value_ptr builtin_macro_define(ast_node_ptr node)
 {
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected juxtaposition");
 
-	auto lhs = get_node(node->binop.lhs);
-	if (lhs->type != AST_SYMBOL_NAME)
+	auto lhs = node.lhs();
+	if (lhs.type() != AST_SYMBOL_NAME)
 		error(node, "definition of non-symbol");
 
-	auto symbol_name = get_symbol_name(lhs);
+	auto symbol = get_symbol(lhs);
 
 	// For functions that are run at compile-time, we allocate
 	// a new global value. The _name_ is still scoped as usual,
 	// though.
-	auto rhs = compile(get_node(node->binop.rhs));
+	auto rhs = compile(node.rhs());
 	auto val = state->scope->make_value(state->context, VALUE_GLOBAL, rhs->type);
-	auto global = new uint8_t[rhs->type->size];
-	val->global.host_address = (void *) global;
+	val->global.host_address = state->scope->alloc_global(rhs->type);
 
-	state->scope->define(state->function, state->source, node, symbol_name, val);
+	state->scope->define(state->function, state->source, node, symbol, val);
 	state->function->emit_move(rhs, val);
 	return val;
 }
@@ -46,18 +46,18 @@ struct elf_data {
 };
 
 struct entry_macro: macro {
-	scope_ptr s;
+	borrowed_scope_ptr s;
 	elf_data &elf;
 
-	entry_macro(scope_ptr s, elf_data &elf):
-		s(s),
+	entry_macro(const scope_ptr &s, elf_data &elf):
+		s(s.get()),
 		elf(elf)
 	{
 	}
 
 	value_ptr invoke(ast_node_ptr node)
 	{
-		if (!is_parent_of(this->s, state->scope))
+		if (!is_parent_of(s, state->scope.get()))
 			error(node, "'entry' used outside defining scope");
 
 		auto entry_value = eval(node);
@@ -72,12 +72,12 @@ struct entry_macro: macro {
 };
 
 struct define_macro: macro {
-	scope_ptr s;
+	borrowed_scope_ptr s;
 	elf_data &elf;
 	bool do_export;
 
-	define_macro(scope_ptr s, elf_data &elf, bool do_export):
-		s(s),
+	define_macro(const scope_ptr &s, elf_data &elf, bool do_export):
+		s(s.get()),
 		elf(elf),
 		do_export(do_export)
 	{
@@ -85,47 +85,47 @@ struct define_macro: macro {
 
 	value_ptr invoke(ast_node_ptr node)
 	{
-		if (node->type != AST_JUXTAPOSE)
+		if (node.type() != AST_JUXTAPOSE)
 			error(node, "expected juxtaposition");
 
-		auto lhs = get_node(node->binop.lhs);
-		if (lhs->type != AST_SYMBOL_NAME)
+		auto lhs = node.lhs();
+		if (lhs.type() != AST_SYMBOL_NAME)
 			error(node, "definition of non-symbol");
 
-		auto symbol_name = get_symbol_name(lhs);
+		auto symbol = get_symbol(lhs);
 
 		// TODO: create new value?
-		auto rhs = (use_scope(s), compile(get_node(node->binop.rhs)));
-		s->define(state->function, state->source, node, symbol_name, rhs);
+		auto rhs = (use_scope(scope_ptr(s)), compile(node.rhs()));
+		s->define(state->function, state->source, node, symbol, rhs);
 
 		if (do_export)
-			elf.exports[symbol_name] = rhs;
+			elf.exports[symbols.name(symbol)] = rhs;
 		return &builtin_value_void;
 	}
 };
 
 struct export_macro: macro {
-	scope_ptr s;
+	borrowed_scope_ptr s;
 	elf_data &elf;
 
-	export_macro(scope_ptr s, elf_data &elf):
-		s(s),
+	export_macro(const scope_ptr &s, elf_data &elf):
+		s(s.get()),
 		elf(elf)
 	{
 	}
 
 	value_ptr invoke(ast_node_ptr node)
 	{
-		if (!is_parent_of(this->s, state->scope))
+		if (!is_parent_of(s, state->scope.get()))
 			error(node, "'export' used outside defining scope");
 
 		// TODO: we really need to implement read vs. write scopes so
 		// that when the user defines something it still becomes visible
 		// in the parent scope
-		auto new_scope = std::make_shared<scope>(state->scope);
-		new_scope->define_builtin_macro("_define", std::make_shared<define_macro>(s, elf, true));
+		scope_frame new_scope(state->scope);
+		new_scope.define_builtin_macro("_define", std::make_shared<define_macro>(scope_ptr(s), elf, true));
 
-		return (use_scope(new_scope), eval(node));
+		return (use_scope(new_scope.ptr()), eval(node));
 	}
 };
 
@@ -227,7 +227,7 @@ static value_ptr builtin_macro_elf(ast_node_ptr node)
 {
 	auto elf_node = node;
 
-	expect(node, node->type == AST_JUXTAPOSE,
+	expect(node, node.type() == AST_JUXTAPOSE,
 		"expected 'elf [attributes...] filename:<expression> <expression>'");
 
 	enum {
@@ -241,12 +241,12 @@ static value_ptr builtin_macro_elf(ast_node_ptr node)
 		OBJECT,
 	} file_type = EXECUTABLE;
 
-	ast_node_ptr lhs_node = get_node(node->binop.lhs);
-	if (lhs_node->type == AST_SQUARE_BRACKETS) {
-		for (auto attribute_node: traverse<AST_COMMA>(state->source->tree, get_node(lhs_node->unop))) {
+	ast_node_ptr lhs_node = node.lhs();
+	if (lhs_node.type() == AST_SQUARE_BRACKETS) {
+		for (auto attribute_node: traverse<AST_COMMA>(lhs_node.unop())) {
 			// XXX: error handling
-			assert(attribute_node->type == AST_SYMBOL_NAME);
-			auto symbol_name = get_symbol_name(attribute_node);
+			assert(attribute_node.type() == AST_SYMBOL_NAME);
+			const auto &symbol_name = get_symbol_name(attribute_node);
 
 			if (symbol_name == "static")
 				linking_type = STATIC;
@@ -262,29 +262,29 @@ static value_ptr builtin_macro_elf(ast_node_ptr node)
 				error(attribute_node, "expected attribute");
 		}
 
-		node = get_node(node->binop.rhs);
+		node = node.rhs();
 	}
 
-	expect(elf_node, node->type == AST_JUXTAPOSE,
+	expect(elf_node, node.type() == AST_JUXTAPOSE,
 		"expected 'elf [attributes...] filename:<expression> <expression>'");
 
-	auto filename_node = get_node(node->binop.lhs);
+	auto filename_node = node.lhs();
 	auto filename_value = eval(filename_node);
 	if (filename_value->storage_type != VALUE_GLOBAL)
 		error(filename_node, "output filename must be known at compile time");
 	if (filename_value->type != builtin_type_str)
 		error(filename_node, "output filename must be a string");
-	auto filename = *(std::string *) filename_value->global.host_address;
+	auto filename = ((str_view *) filename_value->global.host_address)->str();
 
 	elf_data elf;
 	auto objects = std::make_shared<std::vector<object_ptr>>();
 
-	auto new_scope = std::make_shared<scope>(state->scope);
-	new_scope->define_builtin_macro("_define", std::make_shared<define_macro>(new_scope, elf, false));
-	new_scope->define_builtin_macro("entry", std::make_shared<entry_macro>(new_scope, elf));
-	new_scope->define_builtin_macro("export", std::make_shared<export_macro>(new_scope, elf));
+	scope_frame new_scope(state->scope);
+	new_scope.define_builtin_macro("_define", std::make_shared<define_macro>(new_scope.ptr(), elf, false));
+	new_scope.define_builtin_macro("entry", std::make_shared<entry_macro>(new_scope.ptr(), elf));
+	new_scope.define_builtin_macro("export", std::make_shared<export_macro>(new_scope.ptr(), elf));
 
-	use_objects _asdf(objects, new_scope);
+	use_objects _asdf(objects, new_scope.ptr());
 
 	// we allocate the interpreter as an object because we need to get
 	// both its address and its offset
@@ -295,7 +295,7 @@ static value_ptr builtin_macro_elf(ast_node_ptr node)
 		interp_object_id = new_object(interp_object);
 	}
 
-	auto expr_node = get_node(node->binop.rhs);
+	auto expr_node = node.rhs();
 	eval(expr_node);
 
 	elf_writer w(file_type == EXECUTABLE ? exe_vaddr_base : 0);
@@ -456,7 +456,7 @@ static value_ptr builtin_macro_elf(ast_node_ptr node)
 
 			// XXX: this is obviously highly Linux/x86-64-specific.
 
-			auto new_f = std::make_shared<x86_64_function>(state->scope, state->context, false, std::vector<value_type_ptr>(), builtin_type_void);
+			auto new_f = make_ref<x86_64_function>(state->scope, state->context, false, std::vector<value_type_ptr>(), builtin_type_void);
 
 			new_f->emit_call(elf.entry_point);
 			new_f->emit_move_reg_to_reg(RAX, RDI);
@@ -27,11 +27,11 @@
 
 static value_ptr builtin_macro_equals(ast_node_ptr node)
 {
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected juxtaposition");
 
-	auto lhs = compile(get_node(node->binop.lhs));
-	auto rhs = compile(get_node(node->binop.rhs));
+	auto lhs = compile(node.lhs());
+	auto rhs = compile(node.rhs());
 	if (lhs->type != rhs->type)
 		error(node, "cannot compare values of different types");
 
@@ -42,11 +42,11 @@ static value_ptr builtin_macro_equals(ast_node_ptr node)
 
 static value_ptr builtin_macro_notequals(ast_node_ptr node)
 {
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected juxtaposition");
 
-	auto lhs = compile(get_node(node->binop.lhs));
-	auto rhs = compile(get_node(node->binop.rhs));
+	auto lhs = compile(node.lhs());
+	auto rhs = compile(node.rhs());
 	if (lhs->type != rhs->type)
 		error(node, "cannot compare values of different types");
 
@@ -20,7 +20,6 @@
 #define V_BUILTIN_FUN_HH
 
 #include <array>
-#include <set>
 
 #include "ast.hh"
 #include "compile.hh"
@@ -30,14 +29,14 @@
 
 struct return_macro: macro {
 	function_ptr f;
-	scope_ptr s;
+	borrowed_scope_ptr s;
 	value_type_ptr return_type;
 	value_ptr return_value;
 	label_ptr return_label;
 
-	return_macro(function_ptr f, scope_ptr s, value_type_ptr return_type, value_ptr return_value, label_ptr return_label):
+	return_macro(function_ptr f, const scope_ptr &s, value_type_ptr return_type, value_ptr return_value, label_ptr return_label):
 		f(f),
-		s(s),
+		s(s.get()),
 		return_type(return_type),
 		return_value(return_value),
 		return_label(return_label)
@@ -51,7 +50,7 @@ struct return_macro: macro {
 
 		// The scope where we are used must be the scope where we
 		// were defined or a child.
-		if (!is_parent_of(this->s, state->scope))
+		if (!is_parent_of(s, state->scope.get()))
 			error(node, "'return' used outside defining scope");
 
 		f->comment("return");
@@ -74,25 +73,25 @@ struct return_macro: macro {
 // _define inside functions always creates locals
 static value_ptr fun_define_macro(ast_node_ptr node)
 {
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected juxtaposition");
 
-	auto lhs = get_node(node->binop.lhs);
-	if (lhs->type != AST_SYMBOL_NAME)
+	auto lhs = node.lhs();
+	if (lhs.type() != AST_SYMBOL_NAME)
 		error(node, "definition of non-symbol");
 
-	auto symbol_name = get_symbol_name(lhs);
+	auto symbol = get_symbol(lhs);
 
-	auto rhs = compile(get_node(node->binop.rhs));
+	auto rhs = compile(node.rhs());
 	auto val = state->function->alloc_local_value(state->scope, state->context, rhs->type);
-	state->scope->define(state->function, state->source, node, symbol_name, val);
+	state->scope->define(state->function, state->source, node, symbol, val);
 	state->function->emit_move(rhs, val);
 	return val;
 }
 
 // Low-level helper (for use after data has been extracted from syntax)
 static value_ptr __construct_fun(value_type_ptr type, ast_node_ptr node,
-	std::vector<std::string> &args, ast_node_ptr body_node)
+	std::vector<symbol_id> &args, ast_node_ptr body_node)
 {
 	auto c = state->context;
 
@@ -102,11 +101,11 @@ static value_ptr __construct_fun(value_type_ptr type, ast_node_ptr node,
 	// TODO: this is a bit ugly, especially with the downcasting afterwards
 	function_ptr new_f;
 	if (state->objects)
-		new_f = std::make_shared<x86_64_function>(state->scope, c, !state->objects, argument_types, return_type);
+		new_f = make_ref<x86_64_function>(state->scope, c, !state->objects, argument_types, return_type);
 	else
-		new_f = std::make_shared<bytecode_function>(state->scope, c, !state->objects, argument_types, return_type);
+		new_f = make_ref<bytecode_function>(state->scope, c, !state->objects, argument_types, return_type);
 
-	auto new_scope = std::make_shared<scope>(state->scope);
+	scope_frame new_scope(state->scope);
 
 	auto return_label = new_f->new_label();
 
@@ -118,12 +117,12 @@ static value_ptr __construct_fun(value_type_ptr type, ast_node_ptr node,
 	new_f->emit_prologue();
 
 	for (unsigned int i = 0; i < args.size(); ++i)
-		new_scope->define(new_f, state->source, node, args[i], new_f->args_values[i]);
+		new_scope.define(new_f, state->source, node, args[i], new_f->args_values[i]);
 
-	new_scope->define_builtin_macro("_define", fun_define_macro);
-	new_scope->define_builtin_macro("return", std::make_shared<return_macro>(new_f, new_scope, return_type, new_f->return_value, return_label));
+	new_scope.define_builtin_macro("_define", fun_define_macro);
+	new_scope.define_builtin_macro("return", std::make_shared<return_macro>(new_f, new_scope.ptr(), return_type, new_f->return_value, return_label));
 
-	auto v = (use_function(new_f, new_scope), compile(body_node));
+	auto v = (use_function(new_f, new_scope.ptr()), compile(body_node));
 	auto v_type = v->type;
 	if (v_type != return_type)
 		error(node, "wrong return type for function");
@@ -135,22 +134,20 @@ static value_ptr __construct_fun(value_type_ptr type, ast_node_ptr node,
 
 	if (state->objects) {
 		// target
-		auto x86_64_f = std::dynamic_pointer_cast<x86_64_function>(new_f);
+		auto x86_64_f = dynamic_ref_cast<x86_64_function>(new_f);
 		// TODO: use new_state/new_scope?
 		return state->scope->make_value(nullptr, type, new_object(x86_64_f->this_object));
 	} else {
 		// host
-		auto bytecode_f = std::dynamic_pointer_cast<bytecode_function>(new_f);
+		auto bytecode_f = dynamic_ref_cast<bytecode_function>(new_f);
 
 		// We need this to keep the new function from getting freed when this
 		// function returns.
-		// TODO: Another solution?
-		static std::set<function_ptr> functions;
-		functions.insert(bytecode_f);
+		state->scope->make<function_ptr>(bytecode_f);
 
 		auto ret = state->scope->make_value(nullptr, VALUE_GLOBAL, type);
-		auto jf = new jit_function(bytecode_f);
-		ret->global.host_address = new void *(jf);
+		auto jf = state->scope->storage->make<jit_function>(bytecode_f);
+		ret->global.host_address = state->scope->make((void *) jf);
 
 		if (global_disassemble) {
 			printf("host fun: %p\n", jf);
@@ -167,26 +164,26 @@ static value_ptr __construct_fun(value_type_ptr type, ast_node_ptr node,
 //  - 'node' is the function body
 static value_ptr _construct_fun(value_type_ptr type, ast_node_ptr node)
 {
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected (<argument types>...) <body>");
 
-	auto args_node = get_node(node->binop.lhs);
-	if (args_node->type != AST_BRACKETS)
+	auto args_node = node.lhs();
+	if (args_node.type() != AST_BRACKETS)
 		error(node, "expected (<argument names>...)");
 
-	std::vector<std::string> args;
-	for (auto arg_node: traverse<AST_COMMA>(state->source->tree, get_node(args_node->unop))) {
-		if (arg_node->type != AST_SYMBOL_NAME)
+	std::vector<symbol_id> args;
+	for (auto arg_node: traverse<AST_COMMA>(args_node.unop())) {
+		if (arg_node.type() != AST_SYMBOL_NAME)
 			error(node, "expected symbol for argument name");
 
-		auto symbol_name = get_symbol_name(arg_node);
-		args.push_back(symbol_name);
+		auto symbol = get_symbol(arg_node);
+		args.push_back(symbol);
 	}
 
 	if (args.size() != type->argument_types.size())
 		error(node, "expected $ arguments; got $", type->argument_types.size(), args.size());
 
-	auto body_node = get_node(node->binop.rhs);
+	auto body_node = node.rhs();
 	return __construct_fun(type, node, args, body_node);
 }
 
@@ -232,11 +229,11 @@ static value_ptr __call_fun(value_ptr fn, ast_node_ptr node, std::vector<std::pa
 
 static value_ptr _call_fun(value_ptr fn, ast_node_ptr node)
 {
-	if (node->type != AST_BRACKETS)
+	if (node.type() != AST_BRACKETS)
 		error(node, "expected parantheses");
 
 	std::vector<std::pair<ast_node_ptr, value_ptr>> args;
-	for (auto arg_node: traverse<AST_COMMA>(state->source->tree, get_node(node->unop)))
+	for (auto arg_node: traverse<AST_COMMA>(node.unop()))
 		args.push_back(std::make_pair(arg_node, compile(arg_node)));
 
 	return __call_fun(fn, node, args, false);
@@ -255,12 +252,11 @@ static value_ptr _builtin_macro_fun(value_type_ptr ret_type, const std::vector<v
 	type->constructor = _construct_fun;
 	type->argument_types = argument_types;
 	type->return_type = ret_type;
-	type->members["_call"] = std::make_shared<callback_member>(_call_fun);
+	type->members[SYMBOL_CALL] = std::make_shared<callback_member>(_call_fun);
 
 	// XXX: refcounting
 	auto type_value = state->scope->make_value(nullptr, VALUE_GLOBAL, builtin_type_type);
-	auto type_copy = new value_type_ptr(type);
-	type_value->global.host_address = (void *) type_copy;
+	type_value->global.host_address = (void *) state->scope->make(type);
 	return type_value;
 }
 
@@ -268,10 +264,10 @@ static value_ptr builtin_macro_fun(ast_node_ptr node)
 {
 	// Extract parameters and code block from AST
 
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected 'fun <expression> (<expression>)'");
 
-	auto ret_type_node = get_node(node->binop.lhs);
+	auto ret_type_node = node.lhs();
 	auto ret_type_value = eval(ret_type_node);
 	if (ret_type_value->storage_type != VALUE_GLOBAL)
 		error(ret_type_node, "return type must be known at compile time");
@@ -279,14 +275,14 @@ static value_ptr builtin_macro_fun(ast_node_ptr node)
 		error(ret_type_node, "return type must be an instance of a type");
 	auto ret_type = *(value_type_ptr *) ret_type_value->global.host_address;
 
-	auto brackets_node = get_node(node->binop.rhs);
-	if (brackets_node->type != AST_BRACKETS)
+	auto brackets_node = node.rhs();
+	if (brackets_node.type() != AST_BRACKETS)
 		error(brackets_node, "expected (<expression>...)");
 
-	auto args_node = get_node(brackets_node->unop);
+	auto args_node = brackets_node.unop();
 
 	std::vector<value_type_ptr> argument_types;
-	for (auto arg_type_node: traverse<AST_COMMA>(state->source->tree, args_node)) {
+	for (auto arg_type_node: traverse<AST_COMMA>(args_node)) {
 		value_ptr arg_type_value = eval(arg_type_node);
 		if (arg_type_value->storage_type != VALUE_GLOBAL)
 			error(arg_type_node, "argument type must be known at compile time");
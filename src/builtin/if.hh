@@ -34,12 +34,12 @@ static value_ptr builtin_macro_if(ast_node_ptr node)
 	// (juxtapose
 	//     (symbol_name if)
 	//     (juxtapose <-- node
-	//         (symbol_name a) <-- node->binop.lhs AKA condition_node
-	//         (juxtapose      <-- node->binop.rhs AKA rhs
-	//             (symbol_name b) <-- rhs->binop.lhs AKA true_node
-	//             (juxtapose      <-- rhs->binop.rhs AKA rhs
-	//                 (symbol_name else) <-- rhs->binop.lhs AKA else_node
-	//                 (symbol_name b)    <-- rhs->binop.rhs AKA false_node
+	//         (symbol_name a) <-- node.lhs() AKA condition_node
+	//         (juxtapose      <-- node.rhs() AKA rhs
+	//             (symbol_name b) <-- rhs.lhs() AKA true_node
+	//             (juxtapose      <-- rhs.rhs() AKA rhs
+	//                 (symbol_name else) <-- rhs.lhs() AKA else_node
+	//                 (symbol_name b)    <-- rhs.rhs() AKA false_node
 	//             )
 	//         )
 	//     )
@@ -48,26 +48,26 @@ static value_ptr builtin_macro_if(ast_node_ptr node)
 	auto c = state->context;
 	auto f = state->function;
 
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected 'if <expression> <expression>'");
 
-	ast_node_ptr condition_node = get_node(node->binop.lhs);
+	ast_node_ptr condition_node = node.lhs();
 	ast_node_ptr true_node = nullptr;
 	ast_node_ptr false_node = nullptr;
 
-	auto rhs = get_node(node->binop.rhs);
-	if (rhs->type == AST_JUXTAPOSE) {
-		true_node = get_node(rhs->binop.lhs);
+	auto rhs = node.rhs();
+	if (rhs.type() == AST_JUXTAPOSE) {
+		true_node = rhs.lhs();
 
-		rhs = get_node(rhs->binop.rhs);
-		if (rhs->type != AST_JUXTAPOSE)
+		rhs = rhs.rhs();
+		if (rhs.type() != AST_JUXTAPOSE)
 			error(rhs, "expected 'else <expression>'");
 
-		auto else_node = get_node(rhs->binop.lhs);
-		if (else_node->type != AST_SYMBOL_NAME || get_symbol_name(else_node) != "else")
+		auto else_node = rhs.lhs();
+		if (else_node.type() != AST_SYMBOL_NAME || get_symbol(else_node) != SYMBOL_ELSE)
 			error(else_node, "expected 'else'");
 
-		false_node = get_node(rhs->binop.rhs);
+		false_node = rhs.rhs();
 	} else {
 		true_node = rhs;
 	}
@@ -82,7 +82,7 @@ static value_ptr builtin_macro_if(ast_node_ptr node)
 		error(condition_node, "'if' condition must be boolean");
 
 	auto false_label = f->new_label();
-	f->emit_jump_if_zero(condition_value, false_label);
+	f->emit_jump_if_false(condition_value, false_label);
 
 	// "if" block
 	auto true_value = compile(true_node);
@@ -26,6 +26,10 @@
 #include "scope.hh"
 #include "value.hh"
 
+// The values we get out of an imported file may refer to its AST and
+// source buffer (string literals, macros), so we keep those around.
+static std::vector<source_file_ptr> imported_sources;
+
 static value_ptr builtin_macro_import(ast_node_ptr node)
 {
 	// TODO: take dotted path instead of literal filename
@@ -38,21 +42,23 @@ static value_ptr builtin_macro_import(ast_node_ptr node)
 	source_file_ptr source;
 	int source_node;
 	try {
-		source = std::make_shared<mmap_source_file>(literal_string.c_str());
+		source = make_ref<mmap_source_file>(literal_string.c_str());
 		source_node = source->parse();
 	} catch (const std::runtime_error &e) {
 		error(node, e.what());
 	}
 
-	auto new_scope = std::make_shared<scope>(state->scope);
-	(use_source(source, new_scope), compile(source->tree.get(source_node)));
+	imported_sources.push_back(source);
+
+	scope_frame new_scope(state->scope);
+	(use_source(source, new_scope.ptr()), compile(source->tree.get(source_node)));
 
 	// Create new namespace with the contents of the new scope as members
-	auto members = std::map<std::string, member_ptr>();
-	for (auto &it: new_scope->contents) {
+	member_table members;
+	new_scope.for_each([&](symbol_id symbol, const scope::entry &e) {
 		// TODO: preserve location of definition
-		members[it.first] = std::make_shared<namespace_member>(it.second.val);
-	}
+		members[symbol] = std::make_shared<namespace_member>(e.val);
+	});
 
 	auto new_namespace = state->scope->make_value(nullptr, VALUE_CONSTANT,
 		std::make_shared<value_type>(value_type {
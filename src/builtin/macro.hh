@@ -45,10 +45,10 @@ struct user_macro: macro {
 			// XXX: uint64 vs. unsigned long?
 			(uint64_t) &result,
 			(uint64_t) &state,
-			(uint64_t) node,
+			node.to_u64(),
 		};
 
-		run_bytecode(&fn->constants[0], &fn->bytecode[0], &args[0], sizeof(args) / sizeof(*args));
+		run_jit(fn, &args[0], sizeof(args) / sizeof(*args));
 
 		assert(result);
 		return result;
@@ -59,7 +59,7 @@ struct user_macro: macro {
 static void _compile_state_new_scope(uint64_t *args)
 {
 	old_scope = state->scope;
-	auto new_scope = std::make_shared<scope>(state->scope);
+	auto new_scope = make_ref<scope>(state->scope);
 	state->scope = new_scope;
 }
 
@@ -122,14 +122,14 @@ static value_ptr builtin_macro__new_scope(ast_node_ptr node)
 
 static void _builtin_macro__define(uint64_t *args)
 {
-	auto name = (ast_node_ptr) args[0];
+	auto name = ast_node_ptr::from_u64(args[0]);
 	auto value = (value_ptr) args[1];
 
-	if (name->type != AST_SYMBOL_NAME)
+	if (name.type() != AST_SYMBOL_NAME)
 		error(name, "expected symbol");
 
 	assert(value);
-	state->scope->define(state->function, state->source, name, get_symbol_name(name), value);
+	state->scope->define(state->function, state->source, name, get_symbol(name), value);
 }
 
 static value_ptr builtin_macro__define(ast_node_ptr node)
@@ -137,7 +137,7 @@ static value_ptr builtin_macro__define(ast_node_ptr node)
 	expect_type(node, AST_BRACKETS);
 
 	std::vector<std::pair<ast_node_ptr, value_ptr>> args;
-	for (auto arg_node: traverse<AST_COMMA>(state->source->tree, get_node(node->unop)))
+	for (auto arg_node: traverse<AST_COMMA>(node.unop()))
 		args.push_back(std::make_pair(arg_node, compile(arg_node)));
 
 	auto fun_type = std::make_shared<value_type>();
@@ -150,9 +150,7 @@ static value_ptr builtin_macro__define(ast_node_ptr node)
 	fun_type->return_type = builtin_type_void;
 
 	auto val = state->scope->make_value(nullptr, VALUE_GLOBAL, fun_type);
-	auto global = new void *;
-	*global = (void *) &_builtin_macro__define;
-	val->global.host_address = global;
+	val->global.host_address = state->scope->make((void *) &_builtin_macro__define);
 
 	return __call_fun(val, node, args, true);
 }
@@ -160,7 +158,7 @@ static value_ptr builtin_macro__define(ast_node_ptr node)
 static void _builtin_macro__compile(uint64_t *args)
 {
 	auto &retval = *(value_ptr *) args[0];
-	auto node = (ast_node_ptr) args[1];
+	auto node = ast_node_ptr::from_u64(args[1]);
 
 	new (&retval) value_ptr(compile(node));
 }
@@ -170,7 +168,7 @@ static value_ptr builtin_macro__compile(ast_node_ptr node)
 	expect_type(node, AST_BRACKETS);
 
 	std::vector<std::pair<ast_node_ptr, value_ptr>> args;
-	for (auto arg_node: traverse<AST_COMMA>(state->source->tree, get_node(node->unop)))
+	for (auto arg_node: traverse<AST_COMMA>(node.unop()))
 		args.push_back(std::make_pair(arg_node, compile(arg_node)));
 
 	auto fun_type = std::make_shared<value_type>();
@@ -182,9 +180,7 @@ static value_ptr builtin_macro__compile(ast_node_ptr node)
 	fun_type->return_type = builtin_type_value;
 
 	auto val = state->scope->make_value(nullptr, VALUE_GLOBAL, fun_type);
-	auto global = new void *;
-	*global = (void *) &_builtin_macro__compile;
-	val->global.host_address = global;
+	val->global.host_address = state->scope->make((void *) &_builtin_macro__compile);
 
 	return __call_fun(val, node, args, true);
 }
@@ -192,7 +188,7 @@ static value_ptr builtin_macro__compile(ast_node_ptr node)
 static void _builtin_macro__eval(uint64_t *args)
 {
 	auto &retval = *(value_ptr *) args[0];
-	auto node = (ast_node_ptr) args[1];
+	auto node = ast_node_ptr::from_u64(args[1]);
 
 	new (&retval) value_ptr(eval(node));
 }
@@ -202,7 +198,7 @@ static value_ptr builtin_macro__eval(ast_node_ptr node)
 	expect_type(node, AST_BRACKETS);
 
 	std::vector<std::pair<ast_node_ptr, value_ptr>> args;
-	for (auto arg_node: traverse<AST_COMMA>(state->source->tree, get_node(node->unop)))
+	for (auto arg_node: traverse<AST_COMMA>(node.unop()))
 		args.push_back(std::make_pair(arg_node, compile(arg_node)));
 
 	auto fun_type = std::make_shared<value_type>();
@@ -214,40 +210,38 @@ static value_ptr builtin_macro__eval(ast_node_ptr node)
 	fun_type->return_type = builtin_type_value;
 
 	auto val = state->scope->make_value(nullptr, VALUE_GLOBAL, fun_type);
-	auto global = new void *;
-	*global = (void *) &_builtin_macro__eval;
-	val->global.host_address = global;
+	val->global.host_address = state->scope->make((void *) &_builtin_macro__eval);
 
 	return __call_fun(val, node, args, true);
 }
 
 static value_ptr builtin_type_macro_constructor(value_type_ptr type, ast_node_ptr node)
 {
-	auto new_scope = std::make_shared<scope>(state->scope);
-	new_scope->define_builtin_macro("new_scope", builtin_macro__new_scope);
-	new_scope->define_builtin_macro("define", builtin_macro__define);
-	new_scope->define_builtin_macro("compile", builtin_macro__compile);
-	new_scope->define_builtin_macro("eval", builtin_macro__eval);
+	scope_frame new_scope(state->scope);
+	new_scope.define_builtin_macro("new_scope", builtin_macro__new_scope);
+	new_scope.define_builtin_macro("define", builtin_macro__define);
+	new_scope.define_builtin_macro("compile", builtin_macro__compile);
+	new_scope.define_builtin_macro("eval", builtin_macro__eval);
 
 	static std::vector<value_type_ptr> argument_types = {
 		builtin_type_compile_state,
 		builtin_type_ast_node,
 	};
 
-	static auto macro_fun_type_value = _builtin_macro_fun(builtin_type_value, argument_types);
-	static auto macro_fun_type = *(value_type_ptr *) macro_fun_type_value->global.host_address;
+	// The value itself lives in the current session's arena, so only
+	// hold on to the type
+	static auto macro_fun_type = *(value_type_ptr *) _builtin_macro_fun(builtin_type_value, argument_types)->global.host_address;
 
-	std::vector<std::string> args;
-	args.push_back("state");
-	args.push_back("node");
+	std::vector<symbol_id> args;
+	args.push_back(symbols.intern("state"));
+	args.push_back(symbols.intern("node"));
 
-	auto macro_fun = (use_scope(new_scope), __construct_fun(macro_fun_type, node, args, node));
+	auto macro_fun = (use_scope(new_scope.ptr()), __construct_fun(macro_fun_type, node, args, node));
 
 	auto m = std::make_shared<user_macro>(macro_fun);
 
 	auto ret = state->scope->make_value(nullptr, VALUE_GLOBAL, builtin_type_macro);
-	auto global = new macro_ptr(m);
-	ret->global.host_address = (void *) global;
+	ret->global.host_address = (void *) state->scope->make<macro_ptr>(m);
 	return ret;
 }
 
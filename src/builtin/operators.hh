@@ -25,7 +25,7 @@
 #include "scope.hh"
 #include "value.hh"
 
-static value_ptr call_operator_fn(const char *member, ast_node_ptr node)
+static value_ptr call_operator_fn(symbol_id member, ast_node_ptr node)
 {
 	// So this is probably a result of something like (x + y), which got
 	// parsed as (juxtapose _add (juxtapose x y)).
@@ -46,49 +46,54 @@ static value_ptr call_operator_fn(const char *member, ast_node_ptr node)
 	// powerful feature.
 
 	// TODO: bad error message
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected juxtaposition");
 
 	// TODO: only evaluate the type so we don't evaluate the value twice
-	auto lhs = compile(get_node(node->binop.lhs));
+	auto lhs = compile(node.lhs());
 	auto lhs_type = lhs->type;
 
-	auto it = lhs_type->members.find(member);
-	if (it == lhs_type->members.end())
-		error(node, "unknown member '$'", member);
+	struct member *m = lhs_type->members.find(member);
+	if (!m)
+		error(node, "unknown member '$'", symbols.name(member));
 
-	value_ptr val = it->second->invoke(lhs, get_node(node->binop.rhs));
-	return _compile_juxtapose(node, val, get_node(node->binop.rhs));
+	// Builtin types' operators (e.g. u64's _add) are plain functions,
+	// so we don't need to make a macro out of them just to invoke it
+	if (auto fn = m->val_macro_fn())
+		return fn(lhs, node.rhs());
+
+	value_ptr val = m->invoke(lhs, node.rhs());
+	return _compile_juxtapose(node, val, node.rhs());
 }
 
 static value_ptr builtin_macro_add(ast_node_ptr node)
 {
-	return call_operator_fn("_add", node);
+	return call_operator_fn(SYMBOL_ADD, node);
 }
 
 static value_ptr builtin_macro_subtract(ast_node_ptr node)
 {
-	return call_operator_fn("_subtract", node);
+	return call_operator_fn(SYMBOL_SUBTRACT, node);
 }
 
 static value_ptr builtin_macro_less(ast_node_ptr node)
 {
-	return call_operator_fn("_less", node);
+	return call_operator_fn(SYMBOL_LESS, node);
 }
 
 static value_ptr builtin_macro_less_equal(ast_node_ptr node)
 {
-	return call_operator_fn("_less_equal", node);
+	return call_operator_fn(SYMBOL_LESS_EQUAL, node);
 }
 
 static value_ptr builtin_macro_greater(ast_node_ptr node)
 {
-	return call_operator_fn("_greater", node);
+	return call_operator_fn(SYMBOL_GREATER, node);
 }
 
 static value_ptr builtin_macro_greater_equal(ast_node_ptr node)
 {
-	return call_operator_fn("_greater_equal", node);
+	return call_operator_fn(SYMBOL_GREATER_EQUAL, node);
 }
 
 #endif
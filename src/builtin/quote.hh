@@ -29,8 +29,7 @@
 static value_ptr builtin_macro_quote(ast_node_ptr node)
 {
 	auto ret = state->scope->make_value(nullptr, VALUE_GLOBAL, builtin_type_ast_node);
-	auto global = new ast_node_ptr(node);
-	ret->global.host_address = (void *) global;
+	ret->global.host_address = (void *) state->scope->make(node);
 	return ret;
 }
 
@@ -20,32 +20,31 @@
 #define V_BUILTIN_STR_H
 
 #include "compile.hh"
+#include "str_view.hh"
 #include "value.hh"
 
 static value_ptr builtin_type_str_constructor(value_type_ptr, ast_node_ptr);
 
-// TODO: don't use std::string internally
+// Values of type str don't own their contents; see str_view
 static auto builtin_type_str = std::make_shared<value_type>(value_type {
-	.alignment = alignof(std::string),
-	.size = sizeof(std::string),
+	.alignment = alignof(str_view),
+	.size = sizeof(str_view),
 	.constructor = &builtin_type_str_constructor,
 	.argument_types = std::vector<value_type_ptr>(),
 	.return_type = value_type_ptr(),
-	.members = std::map<std::string, member_ptr>({
+	.members = member_table({
 		// TODO
 	}),
 });
 
 static value_ptr builtin_type_str_constructor(value_type_ptr, ast_node_ptr node)
 {
-	if (node->type != AST_LITERAL_STRING)
+	if (node.type() != AST_LITERAL_STRING)
 		error(node, "expected literal string");
 
 	auto ret = state->scope->make_value(nullptr, VALUE_GLOBAL, builtin_type_str);
 
-	auto global = new std::string;
-	*global = get_literal_string(node);
-	ret->global.host_address = (void *) global;
+	ret->global.host_address = (void *) state->scope->make(node.string());
 	return ret;
 }
 
@@ -79,19 +79,19 @@ struct struct_declare_macro: macro {
 
 	value_ptr invoke(ast_node_ptr node)
 	{
-		if (node->type != AST_JUXTAPOSE)
+		if (node.type() != AST_JUXTAPOSE)
 			error(node, "expected juxtaposition");
 
-		auto name_node = get_node(node->binop.lhs);
-		if (name_node->type != AST_SYMBOL_NAME)
+		auto name_node = node.lhs();
+		if (name_node.type() != AST_SYMBOL_NAME)
 			error(name_node, "expected symbol for member name");
 
-		auto field_name = get_symbol_name(name_node);
+		auto field_name = get_symbol(name_node);
 
 		// TODO: we should call eval() here with a scope that
 		// "undefines" _declare so we get the normal definition
 		// of it
-		auto type_node = get_node(node->binop.rhs);
+		auto type_node = node.rhs();
 		auto type_value = eval(type_node);
 		assert(type_value->storage_type == VALUE_GLOBAL);
 		expect_type(node, type_value, builtin_type_type);
@@ -120,19 +120,18 @@ static value_ptr builtin_macro_struct(ast_node_ptr node)
 	type->alignment = alignof(unsigned long);
 	type->constructor = &_struct_constructor;
 
-	auto new_scope = std::make_shared<scope>(state->scope);
+	scope_frame new_scope(state->scope);
 	auto macro = std::make_shared<struct_declare_macro>(type);
-	new_scope->define_builtin_macro("_declare", macro);
+	new_scope.define_builtin_macro("_declare", macro);
 
-	(use_scope(new_scope), compile(node));
+	(use_scope(new_scope.ptr()), compile(node));
 
 	// Align the final size for arrays
 	type->size = (macro->offset + type->alignment - 1) & ~(type->alignment - 1);
 
 	// XXX: refcounting
 	auto type_value = state->scope->make_value(state->context, VALUE_GLOBAL, builtin_type_type);
-	auto type_copy = new value_type_ptr(type);
-	type_value->global.host_address = (void *) type_copy;
+	type_value->global.host_address = (void *) state->scope->make(type);
 	return type_value;
 }
 
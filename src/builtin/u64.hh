@@ -34,10 +34,14 @@ struct macrofy_callback_member: member {
 	{
 		auto m = std::make_shared<val_macro>(fn, v);
 		auto macro_value = state->scope->make_value(nullptr, VALUE_GLOBAL, builtin_type_macro);
-		auto macro_copy = new macro_ptr(m);
-		macro_value->global.host_address = (void *) macro_copy;
+		macro_value->global.host_address = (void *) state->scope->make<macro_ptr>(m);
 		return macro_value;
 	}
+
+	val_macro_fn_type val_macro_fn()
+	{
+		return fn;
+	}
 };
 
 static value_ptr builtin_type_u64_constructor(value_type_ptr, ast_node_ptr);
@@ -51,25 +55,38 @@ static auto builtin_type_u64 = std::make_shared<value_type>(value_type {
 	.constructor = &builtin_type_u64_constructor,
 	.argument_types = std::vector<value_type_ptr>(),
 	.return_type = value_type_ptr(),
-	.members = std::map<std::string, member_ptr>({
-		{"_add", std::make_shared<macrofy_callback_member>(&builtin_type_u64_add)},
-		{"_subtract", std::make_shared<macrofy_callback_member>(&builtin_type_u64_subtract)},
-		{"_less", std::make_shared<macrofy_callback_member>(&builtin_type_u64_less)},
+	.members = member_table({
+		{SYMBOL_ADD, std::make_shared<macrofy_callback_member>(&builtin_type_u64_add)},
+		{SYMBOL_SUBTRACT, std::make_shared<macrofy_callback_member>(&builtin_type_u64_subtract)},
+		{SYMBOL_LESS, std::make_shared<macrofy_callback_member>(&builtin_type_u64_less)},
 	}),
 });
 
 static value_ptr builtin_type_u64_constructor(value_type_ptr, ast_node_ptr node)
 {
 	// TODO: support conversion from other integer types?
-	if (node->type != AST_LITERAL_INTEGER)
+	if (node.type() != AST_LITERAL_INTEGER)
 		error(node, "expected literal integer");
 
-	auto literal_integer = get_literal_integer(node);
-	if (!literal_integer.fits_ulong_p())
-		error(node, "literal integer is too large to fit in u64");
+	if (!node.is_valid_integer())
+		error(node, "invalid literal integer");
+
+	uint64_t value;
+	if (node.is_small_integer()) {
+		if (node.small_integer() < 0)
+			error(node, "literal integer is too large to fit in u64");
+
+		value = node.small_integer();
+	} else {
+		const mpz_class &literal_integer = node.big_integer();
+		if (!literal_integer.fits_ulong_p())
+			error(node, "literal integer is too large to fit in u64");
+
+		value = literal_integer.get_ui();
+	}
 
 	auto ret = state->scope->make_value(nullptr, VALUE_CONSTANT, builtin_type_u64);
-	ret->constant.u64 = literal_integer.get_si();
+	ret->constant.u64 = value;
 	return ret;
 }
 
@@ -27,16 +27,16 @@
 
 static value_ptr builtin_macro_use(ast_node_ptr node)
 {
-	auto new_scope = std::make_shared<scope>(state->scope);
-	auto v = (use_scope(new_scope), compile(node));
+	scope_frame new_scope(state->scope);
+	auto v = (use_scope(new_scope.ptr()), compile(node));
 
 	// Move each newly defined variable to the current scope
-	for (auto &it: v->type->members) {
+	v->type->members.for_each([&](symbol_id symbol, const member_ptr &m) {
 		// XXX: what about shadowed variables? should probably be an error
 		// XXX: preserve location of original definition
 		// XXX: should we really invoke the macro here?
-		state->scope->define(nullptr, nullptr, nullptr, it.first, it.second->invoke(v, node));
-	}
+		state->scope->define(nullptr, nullptr, nullptr, symbol, m->invoke(v, node));
+	});
 
 	return &builtin_value_void;
 }
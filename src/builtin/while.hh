@@ -28,12 +28,12 @@
 
 struct break_macro: macro {
 	function_ptr f;
-	scope_ptr s;
+	borrowed_scope_ptr s;
 	label_ptr done_label;
 
-	break_macro(function_ptr f, scope_ptr s, label_ptr done_label):
+	break_macro(function_ptr f, const scope_ptr &s, label_ptr done_label):
 		f(f),
-		s(s),
+		s(s.get()),
 		done_label(done_label)
 	{
 	}
@@ -45,7 +45,7 @@ struct break_macro: macro {
 
 		// The scope where we are used must be the scope where we
 		// were defined or a child.
-		if (!is_parent_of(this->s, state->scope))
+		if (!is_parent_of(s, state->scope.get()))
 			error(node, "'break' used outside defining scope");
 
 		state->function->comment("break");
@@ -57,12 +57,12 @@ struct break_macro: macro {
 
 struct continue_macro: macro {
 	function_ptr f;
-	scope_ptr s;
+	borrowed_scope_ptr s;
 	label_ptr loop_label;
 
-	continue_macro(function_ptr f, scope_ptr s, label_ptr loop_label):
+	continue_macro(function_ptr f, const scope_ptr &s, label_ptr loop_label):
 		f(f),
-		s(s),
+		s(s.get()),
 		loop_label(loop_label)
 	{
 	}
@@ -74,7 +74,7 @@ struct continue_macro: macro {
 
 		// The scope where we are used must be the scope where we
 		// were defined or a child.
-		if (!is_parent_of(this->s, state->scope))
+		if (!is_parent_of(s, state->scope.get()))
 			error(node, "'continue' used outside defining scope");
 
 		state->function->comment("continue");
@@ -92,11 +92,11 @@ static value_ptr builtin_macro_while(ast_node_ptr node)
 
 	f->comment("while");
 
-	if (node->type != AST_JUXTAPOSE)
+	if (node.type() != AST_JUXTAPOSE)
 		error(node, "expected 'while <expression> <expression>'");
 
-	auto condition_node = get_node(node->binop.lhs);
-	auto body_node = get_node(node->binop.rhs);
+	auto condition_node = node.lhs();
+	auto body_node = node.rhs();
 
 	auto loop_label = f->new_label();
 	f->emit_label(loop_label);
@@ -107,14 +107,14 @@ static value_ptr builtin_macro_while(ast_node_ptr node)
 		error(condition_node, "'while' condition must be boolean");
 
 	auto done_label = f->new_label();
-	f->emit_jump_if_zero(condition_value, done_label);
+	f->emit_jump_if_false(condition_value, done_label);
 
 	// body
-	auto new_scope = std::make_shared<scope>(state->scope);
-	new_scope->define_builtin_macro("break", std::make_shared<break_macro>(f, new_scope, done_label));
-	new_scope->define_builtin_macro("continue", std::make_shared<break_macro>(f, new_scope, loop_label));
+	scope_frame new_scope(state->scope);
+	new_scope.define_builtin_macro("break", std::make_shared<break_macro>(f, new_scope.ptr(), done_label));
+	new_scope.define_builtin_macro("continue", std::make_shared<break_macro>(f, new_scope.ptr(), loop_label));
 
-	(use_scope(new_scope), compile(body_node));
+	(use_scope(new_scope.ptr()), compile(body_node));
 	f->emit_jump(loop_label);
 
 	f->emit_label(done_label);
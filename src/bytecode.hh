@@ -21,6 +21,9 @@
 
 #include <stdarg.h>
 
+#include <algorithm>
+#include <unordered_map>
+
 #include "function.hh"
 #include "globals.hh"
 #include "scope.hh"
@@ -70,6 +73,7 @@
 #define bytecode_opcode(X) \
 	X(LOAD_CONSTANT) \
 	X(LOAD_CONSTANT2) \
+	X(LOAD_CONSTANT4) \
 	X(LOAD_LOCAL) \
 	X(LOAD_LOCAL2) \
 	X(LOAD_LOCAL_ADDRESS) \
@@ -106,21 +110,196 @@
 	X(GT) \
 	X(GTE) \
 	\
-	X(JUMP) \
-	X(JUMP_IF_ZERO) \
+	X(JUMP_REL) \
+	X(JUMP_IF_ZERO_REL) \
+	X(JEQ) \
+	X(JNEQ) \
+	X(JLT) \
+	X(JLTE) \
+	X(JGT) \
+	X(JGTE) \
 	X(CALL) \
 	X(C_CALL) \
-	X(RETURN)
+	X(RETURN) \
+	\
+	X(MOVE_LOCAL) \
+	X(JUMP_IF_ZERO_LOCAL) \
+	X(STORE_LOCAL_PTR_OFF) \
+	\
+	X(ADD_LLL) \
+	X(SUB_LLL) \
+	X(EQ_LLL) \
+	X(NEQ_LLL) \
+	X(LT_LLL) \
+	X(LTE_LLL) \
+	X(GT_LLL) \
+	X(GTE_LLL) \
+	\
+	X(ADD_LCL) \
+	X(SUB_LCL) \
+	X(EQ_LCL) \
+	X(NEQ_LCL) \
+	X(LT_LCL) \
+	X(LTE_LCL) \
+	X(GT_LCL) \
+	X(GTE_LCL) \
+	\
+	X(JEQ_LL) \
+	X(JNEQ_LL) \
+	X(JLT_LL) \
+	X(JLTE_LL) \
+	X(JGT_LL) \
+	X(JGTE_LL) \
+	\
+	X(JEQ_LC) \
+	X(JNEQ_LC) \
+	X(JLT_LC) \
+	X(JLTE_LC) \
+	X(JGT_LC) \
+	X(JGTE_LC)
 
 DEFINE_ENUM(bytecode_opcode)
 
+// Jumps
+//
+// JUMP_REL, JUMP_IF_ZERO_REL and the J<op> instructions (which compare
+// the two operands on the stack and jump if <op> holds) are followed by
+// a 32-bit target, relative to the start of the instruction. Jumps to
+// a label that hasn't been emitted yet are patched by emit_label().
+//
+// Superinstructions
+//
+// The emit_*() functions below only use the simple instructions above.
+// Once a function is complete, fuse_superinstructions() replaces the
+// most common sequences with single instructions, which
+// all take fixed-size operands: 16-bit local indices and 32-bit
+// constant indices (and jump targets, as above).
+//
+//   MOVE_LOCAL l1 l2         LOAD_LOCAL l1; STORE_LOCAL l2
+//   JUMP_IF_ZERO_LOCAL l t   LOAD_LOCAL l; JUMP_IF_ZERO_REL t
+//   STORE_LOCAL_PTR_OFF l c  LOAD_LOCAL l; LOAD_CONSTANT c; ADD; STORE_GLOBAL64
+//   <op>_LLL l1 l2 l3        LOAD_LOCAL l1; LOAD_LOCAL l2; <op>; STORE_LOCAL l3
+//   <op>_LCL l1 c l2         LOAD_LOCAL l1; LOAD_CONSTANT c; <op>; STORE_LOCAL l2
+//   J<op>_LL l1 l2 t         LOAD_LOCAL l1; LOAD_LOCAL l2; J<op> t
+//   J<op>_LC l c t           LOAD_LOCAL l; LOAD_CONSTANT c; J<op> t
+
+// The comparisons, with the C operators that implement them
+#define bytecode_compare_op(X) \
+	X(EQ, ==) \
+	X(NEQ, !=) \
+	X(LT, <) \
+	X(LTE, <=) \
+	X(GT, >) \
+	X(GTE, >=)
+
+// The <op>s above
+#define bytecode_fused_binop(X) \
+	X(ADD, +) \
+	X(SUB, -) \
+	bytecode_compare_op(X)
+
+static uint16_t bytecode_u16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t bytecode_u32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// One instruction as emitted by the emit_*() functions: its opcode
+// and operand (if any), whatever the size of the operand.
+struct bytecode_insn {
+	unsigned int offset;
+	unsigned int size;
+	uint8_t opcode;
+	unsigned int index;
+
+	bytecode_insn(const std::vector<uint8_t> &bytes, unsigned int offset):
+		offset(offset),
+		size(1),
+		opcode(bytes[offset]),
+		index(0)
+	{
+		const uint8_t *p = &bytes[offset + 1];
+
+		switch (opcode) {
+		case LOAD_CONSTANT:
+		case LOAD_LOCAL:
+		case LOAD_LOCAL_ADDRESS:
+		case LOAD_ARG:
+		case STORE_LOCAL:
+			index = p[0];
+			size = 2;
+			break;
+		case LOAD_CONSTANT2:
+		case LOAD_LOCAL2:
+		case LOAD_LOCAL2_ADDRESS:
+		case STORE_LOCAL2:
+			index = bytecode_u16(p);
+			size = 3;
+			break;
+		case LOAD_CONSTANT4:
+		case JUMP_REL:
+		case JUMP_IF_ZERO_REL:
+		case JEQ:
+		case JNEQ:
+		case JLT:
+		case JLTE:
+		case JGT:
+		case JGTE:
+			index = bytecode_u32(p);
+			size = 5;
+			break;
+		default:
+			// Nothing else has operands (before fusing)
+			assert(opcode < MOVE_LOCAL);
+			break;
+		}
+	}
+
+	bool is_jump() const
+	{
+		return opcode >= JUMP_REL && opcode <= JGTE;
+	}
+
+	// Only for is_jump()
+	unsigned int target() const
+	{
+		return offset + (int32_t) index;
+	}
+
+	bool is_load_constant() const
+	{
+		return opcode == LOAD_CONSTANT || opcode == LOAD_CONSTANT2 || opcode == LOAD_CONSTANT4;
+	}
+
+	bool is_load_local() const
+	{
+		return opcode == LOAD_LOCAL || opcode == LOAD_LOCAL2;
+	}
+
+	bool is_store_local() const
+	{
+		return opcode == STORE_LOCAL || opcode == STORE_LOCAL2;
+	}
+};
+
 struct bytecode_label:
 	label
 {
-	// constant pool index
-	// This is all we need. When linking the label, we just update the
-	// constant pool entry with the label's address and we're done.
-	unsigned int constant_i;
+	// -1 until emit_label()
+	int offset;
+
+	// Jumps to this label from before it was emitted: the offset of
+	// each jump instruction and of its target operand
+	std::vector<std::pair<unsigned int, unsigned int>> jumps;
+
+	bytecode_label():
+		offset(-1)
+	{
+	}
 };
 
 struct bytecode_function:
@@ -128,6 +307,20 @@ struct bytecode_function:
 {
 	std::vector<uint64_t> constants;
 
+	// Index of each value in 'constants', so that we only store it once
+	std::unordered_map<uint64_t, unsigned int> constant_indices;
+
+	// What the last emit_compare() emitted, so that
+	// emit_jump_if_false() can turn it into a compare-and-jump
+	struct {
+		size_t start;
+		size_t end;
+		compare_op op;
+		value_ptr source1;
+		value_ptr source2;
+		value_ptr dest;
+	} last_compare;
+
 	// XXX: the double indirection is bad, we should collect bytes
 	// ourselves directly and then move it into the object at the end
 	std::vector<uint8_t> &bytes;
@@ -154,6 +347,8 @@ struct bytecode_function:
 		max_nr_args(0),
 		nr_locals(0)
 	{
+		last_compare.dest = nullptr;
+
 		// XXX: bytecode ABI..?
 
 		for (auto arg_type: args_types) {
@@ -216,6 +411,12 @@ struct bytecode_function:
 		bytes.push_back(v);
 	}
 
+	void emit_short(uint16_t v)
+	{
+		bytes.push_back(v);
+		bytes.push_back(v >> 8);
+	}
+
 	void emit_long(uint32_t v)
 	{
 		bytes.push_back(v);
@@ -224,6 +425,38 @@ struct bytecode_function:
 		bytes.push_back(v >> 24);
 	}
 
+	unsigned int add_constant(uint64_t v)
+	{
+		auto it = constant_indices.find(v);
+		if (it != constant_indices.end())
+			return it->second;
+
+		unsigned int index = constants.size();
+		constants.push_back(v);
+		constant_indices.emplace(v, index);
+		return index;
+	}
+
+	void emit_load_constant_index(unsigned int index)
+	{
+		if (index < 256) {
+			emit(LOAD_CONSTANT);
+			emit(index);
+		} else if (index < 65536) {
+			emit(LOAD_CONSTANT2);
+			emit(index);
+			emit(index >> 8);
+		} else {
+			emit(LOAD_CONSTANT4);
+			emit_long(index);
+		}
+	}
+
+	void emit_load_constant(uint64_t v)
+	{
+		emit_load_constant_index(add_constant(v));
+	}
+
 	void emit_prologue()
 	{
 		function_enter(this, "emit_prologue");
@@ -251,10 +484,262 @@ struct bytecode_function:
 
 	void emit_epilogue()
 	{
-		function_enter(this, "emit_epilogue");
+		{
+			function_enter(this, "emit_epilogue");
+
+			emit_move(return_value, local_return_value);
+			emit(RETURN);
+		}
 
-		emit_move(return_value, local_return_value);
-		emit(RETURN);
+		if (global_superinstructions)
+			fuse_superinstructions();
+	}
+
+	// A jump in the code that fuse_superinstructions() is building,
+	// with its target in the old code
+	struct fused_jump {
+		unsigned int insn;
+		unsigned int operand;
+		unsigned int target;
+	};
+
+	void emit_fused_jump(std::vector<fused_jump> &jumps, unsigned int insn, const bytecode_insn &old_jump)
+	{
+		jumps.push_back({ insn, (unsigned int) bytes.size(), old_jump.target() });
+		emit_long(0);
+	}
+
+	// Emits the superinstruction for insns[i...] (and returns the
+	// number of instructions it replaces) if there is one. It may use
+	// at most 'n' instructions (since jump targets must stay at the
+	// start of an instruction).
+	unsigned int emit_superinstruction(const std::vector<bytecode_insn> &insns, unsigned int i, unsigned int n, std::vector<fused_jump> &jumps)
+	{
+		unsigned int start = bytes.size();
+
+		auto &a = insns[i];
+		if (n < 2 || !a.is_load_local())
+			return 0;
+
+		auto &b = insns[i + 1];
+		if (b.is_store_local()) {
+			emit(MOVE_LOCAL);
+			emit_short(a.index);
+			emit_short(b.index);
+			return 2;
+		}
+
+		if (b.opcode == JUMP_IF_ZERO_REL) {
+			emit(JUMP_IF_ZERO_LOCAL);
+			emit_short(a.index);
+			emit_fused_jump(jumps, start, b);
+			return 2;
+		}
+
+		if (n < 3)
+			return 0;
+
+		static const uint8_t compares[] = {
+#define _FUSED_COMPARE(name, op) J##name,
+			bytecode_compare_op(_FUSED_COMPARE)
+#undef _FUSED_COMPARE
+		};
+
+		static const std::pair<uint8_t, uint8_t> fused_compares[] = {
+#define _FUSED_COMPARE(name, op) { J##name##_LL, J##name##_LC },
+			bytecode_compare_op(_FUSED_COMPARE)
+#undef _FUSED_COMPARE
+		};
+
+		auto &c = insns[i + 2];
+		for (unsigned int j = 0; j < sizeof(compares) / sizeof(*compares); ++j) {
+			if (c.opcode != compares[j])
+				continue;
+
+			if (b.is_load_local()) {
+				emit(fused_compares[j].first);
+				emit_short(a.index);
+				emit_short(b.index);
+				emit_fused_jump(jumps, start, c);
+				return 3;
+			}
+
+			if (b.is_load_constant()) {
+				emit(fused_compares[j].second);
+				emit_short(a.index);
+				emit_long(b.index);
+				emit_fused_jump(jumps, start, c);
+				return 3;
+			}
+		}
+
+		if (n < 4)
+			return 0;
+
+		auto &d = insns[i + 3];
+		if (b.is_load_constant() && c.opcode == ADD && d.opcode == STORE_GLOBAL64) {
+			emit(STORE_LOCAL_PTR_OFF);
+			emit_short(a.index);
+			emit_long(b.index);
+			return 4;
+		}
+
+		if (!d.is_store_local())
+			return 0;
+
+		static const std::pair<uint8_t, uint8_t> fused[] = {
+#define _FUSED_BINOP(name, op) { name##_LLL, name##_LCL },
+			bytecode_fused_binop(_FUSED_BINOP)
+#undef _FUSED_BINOP
+		};
+
+		static const uint8_t binops[] = {
+#define _FUSED_BINOP(name, op) name,
+			bytecode_fused_binop(_FUSED_BINOP)
+#undef _FUSED_BINOP
+		};
+
+		for (unsigned int j = 0; j < sizeof(binops) / sizeof(*binops); ++j) {
+			if (c.opcode != binops[j])
+				continue;
+
+			if (b.is_load_local()) {
+				emit(fused[j].first);
+				emit_short(a.index);
+				emit_short(b.index);
+				emit_short(d.index);
+				return 4;
+			}
+
+			if (b.is_load_constant()) {
+				emit(fused[j].second);
+				emit_short(a.index);
+				emit_long(b.index);
+				emit_short(d.index);
+				return 4;
+			}
+		}
+
+		return 0;
+	}
+
+	void fuse_superinstructions()
+	{
+		std::vector<uint8_t> old_bytes;
+		old_bytes.swap(bytes);
+
+		bytes.reserve(old_bytes.size());
+
+		std::vector<bytecode_insn> insns;
+		insns.reserve(old_bytes.size() / 2);
+		for (unsigned int i = 0; i < old_bytes.size(); i += insns.back().size)
+			insns.push_back(bytecode_insn(old_bytes, i));
+
+		// Jump targets, in order. Jump targets and comments are both
+		// always at the start of an instruction (or at the very end),
+		// so we can go through them as we go through the code.
+		std::vector<unsigned int> targets;
+		for (const auto &insn: insns) {
+			if (insn.is_jump())
+				targets.push_back(insn.target());
+		}
+		std::sort(targets.begin(), targets.end());
+
+		auto target_it = targets.begin();
+		auto comment_it = comments.begin();
+
+		// Where each instruction ended up, for the instructions that
+		// start a (super)instruction
+		std::vector<unsigned int> new_offset(insns.size());
+
+		std::vector<fused_jump> jumps;
+
+		// Instructions that we keep are copied over in runs; this
+		// is where the current run started
+		unsigned int copy_from = 0;
+
+		for (unsigned int i = 0; i < insns.size(); ) {
+			unsigned int offset = insns[i].offset;
+			unsigned int start = bytes.size() + offset - copy_from;
+			new_offset[i] = start;
+
+			while (target_it != targets.end() && *target_it <= offset)
+				++target_it;
+			while (comment_it != comments.end() && comment_it->offset <= offset)
+				(comment_it++)->offset = start;
+
+			unsigned int n = 4;
+			if (target_it != targets.end()) {
+				for (unsigned int j = 1; j < n; ++j) {
+					if (i + j < insns.size() && insns[i + j].offset >= *target_it)
+						n = j;
+				}
+			}
+
+			if (i + n > insns.size())
+				n = insns.size() - i;
+
+			unsigned int pos = bytes.size();
+			unsigned int nr_jumps = jumps.size();
+			n = emit_superinstruction(insns, i, n, jumps);
+			if (!n) {
+				// The offset will be different, so we need to
+				// patch it like the ones we emit
+				if (insns[i].is_jump())
+					jumps.push_back({ start, start + 1, insns[i].target() });
+
+				++i;
+				continue;
+			}
+
+			// The instructions we kept since the last superinstruction
+			bytes.insert(bytes.begin() + pos, old_bytes.begin() + copy_from, old_bytes.begin() + offset);
+			for (unsigned int j = nr_jumps; j < jumps.size(); ++j) {
+				jumps[j].insn += start - pos;
+				jumps[j].operand += start - pos;
+			}
+
+			unsigned int end = insns[i + n - 1].offset + insns[i + n - 1].size;
+
+			// Comments inside what we just fused go before it
+			while (comment_it != comments.end() && comment_it->offset < end)
+				(comment_it++)->offset = start;
+
+			copy_from = end;
+			i += n;
+		}
+
+		bytes.insert(bytes.end(), old_bytes.begin() + copy_from, old_bytes.end());
+
+		for (; comment_it != comments.end(); ++comment_it)
+			comment_it->offset = bytes.size();
+
+		// Where a jump to 'target' (in the old code) should go now
+		auto new_target = [&](unsigned int target) -> unsigned int {
+			if (target == old_bytes.size())
+				return bytes.size();
+
+			auto it = std::lower_bound(insns.begin(), insns.end(), target,
+				[](const bytecode_insn &insn, unsigned int offset) { return insn.offset < offset; });
+			assert(it != insns.end() && it->offset == target);
+			return new_offset[it - insns.begin()];
+		};
+
+		for (const auto &jump: jumps) {
+			// A jump to a jump can go straight to where that one
+			// goes (but not around in circles forever)
+			unsigned int target = jump.target;
+			for (unsigned int k = 0; k < 8; ++k) {
+				auto it = std::lower_bound(insns.begin(), insns.end(), target,
+					[](const bytecode_insn &insn, unsigned int offset) { return insn.offset < offset; });
+				if (it == insns.end() || it->opcode != JUMP_REL)
+					break;
+
+				target = it->target();
+			}
+
+			patch_jump(jump.insn, jump.operand, new_target(target));
+		}
 	}
 
 	void emit_load_global(unsigned int size)
@@ -282,11 +767,7 @@ struct bytecode_function:
 		switch (value->storage_type) {
 		case VALUE_GLOBAL:
 			{
-				unsigned int index = constants.size();
-				constants.push_back((uint64_t) value->global.host_address + offset);
-
-				emit(LOAD_CONSTANT);
-				emit(index);
+				emit_load_constant((uint64_t) value->global.host_address + offset);
 				emit_load_global(size);
 			}
 			break;
@@ -318,13 +799,7 @@ struct bytecode_function:
 			// TODO
 			assert(offset == 0);
 
-			{
-				unsigned int index = constants.size();
-				constants.push_back(value->constant.u64);
-
-				emit(LOAD_CONSTANT);
-				emit(index);
-			}
+			emit_load_constant(value->constant.u64);
 			break;
 		default:
 			assert(false);
@@ -338,23 +813,12 @@ struct bytecode_function:
 		emit_load_offset(value, 0, value->type->size);
 	}
 
-	void emit_load(label_ptr super_label)
-	{
-		auto l = std::dynamic_pointer_cast<bytecode_label>(super_label);
-		emit(LOAD_CONSTANT);
-		emit(l->constant_i);
-	}
-
 	void emit_load_address(value_ptr value, unsigned int offset)
 	{
 		switch (value->storage_type) {
 		case VALUE_GLOBAL:
 			{
-				unsigned int index = constants.size();
-				constants.push_back((uint64_t) value->global.host_address + offset);
-
-				emit(LOAD_CONSTANT);
-				emit(index);
+				emit_load_constant((uint64_t) value->global.host_address + offset);
 			}
 			break;
 		case VALUE_LOCAL:
@@ -424,11 +888,7 @@ struct bytecode_function:
 		switch (value->storage_type) {
 		case VALUE_GLOBAL:
 			{
-				unsigned int index = constants.size();
-				constants.push_back((uint64_t) value->global.host_address + offset);
-
-				emit(LOAD_CONSTANT);
-				emit(index);
+				emit_load_constant((uint64_t) value->global.host_address + offset);
 				emit_store_global(size);
 			}
 			break;
@@ -473,14 +933,7 @@ struct bytecode_function:
 			}
 
 			// XXX: not so happy about this... pretty inefficient
-			{
-				unsigned int index = constants.size();
-				constants.push_back((uint64_t) offset);
-
-				emit(LOAD_CONSTANT);
-				emit(index);
-			}
-
+			emit_load_constant(offset);
 			emit(ADD);
 
 			emit_store_global(size);
@@ -551,6 +1004,8 @@ struct bytecode_function:
 			[CMP_GREATER_EQUAL] = GTE,
 		};
 
+		last_compare.start = bytes.size();
+
 		emit_load(source1);
 		emit_load(source2);
 
@@ -558,48 +1013,106 @@ struct bytecode_function:
 		emit(opcodes[op]);
 
 		emit_store(dest);
+
+		last_compare.end = bytes.size();
+		last_compare.op = op;
+		last_compare.source1 = source1;
+		last_compare.source2 = source2;
+		last_compare.dest = dest;
 	}
 
 	label_ptr new_label()
 	{
-		auto l = std::make_shared<bytecode_label>();
-		l->constant_i = constants.size();
-		constants.push_back(/* Dummy */ 0);
-		return l;
+		return std::make_shared<bytecode_label>();
+	}
+
+	void patch_jump(unsigned int insn, unsigned int operand, unsigned int target)
+	{
+		uint32_t v = target - insn;
+		bytes[operand] = v;
+		bytes[operand + 1] = v >> 8;
+		bytes[operand + 2] = v >> 16;
+		bytes[operand + 3] = v >> 24;
 	}
 
 	void emit_label(label_ptr super_label)
 	{
 		auto l = std::dynamic_pointer_cast<bytecode_label>(super_label);
-		constants[l->constant_i] = bytes.size();
+		assert(l->offset == -1);
+		l->offset = bytes.size();
+
+		for (const auto &jump: l->jumps)
+			patch_jump(jump.first, jump.second, l->offset);
+		l->jumps.clear();
+
+		// We can't take back the code before a label that
+		// something may be jumping to
+		last_compare.dest = nullptr;
 	}
 
 	void link_label(label_ptr super_label)
 	{
-		// This function intentionally left blank!
-		//
-		// (Instructions already refer to a constant pool index which
-		// is updated in emit_label().)
+		// Everything was already patched in emit_label()
+		auto l = std::dynamic_pointer_cast<bytecode_label>(super_label);
+		assert(l->jumps.empty());
+	}
+
+	void emit_jump(uint8_t opcode, label_ptr super_target)
+	{
+		auto l = std::dynamic_pointer_cast<bytecode_label>(super_target);
+
+		unsigned int insn = bytes.size();
+		emit(opcode);
+
+		if (l->offset == -1)
+			l->jumps.push_back(std::make_pair(insn, bytes.size()));
+		emit_long(l->offset - insn);
 	}
 
 	void emit_jump(label_ptr super_target)
 	{
-		emit_load(super_target);
-		emit(JUMP);
+		emit_jump(JUMP_REL, super_target);
 	}
 
 	void emit_jump_if_zero(value_ptr value, label_ptr super_target)
 	{
-		emit_load(super_target);
 		emit_load(value);
-		emit(JUMP_IF_ZERO);
+		emit_jump(JUMP_IF_ZERO_REL, super_target);
+	}
+
+	void emit_jump_if_false(value_ptr value, label_ptr super_target)
+	{
+		if (value != last_compare.dest || bytes.size() != last_compare.end) {
+			emit_jump_if_zero(value, super_target);
+			return;
+		}
+
+		// Jump if the comparison doesn't hold
+		static const uint8_t opcodes[] = {
+			[CMP_EQ] = JNEQ,
+			[CMP_NEQ] = JEQ,
+			[CMP_LESS] = JGTE,
+			[CMP_LESS_EQUAL] = JGT,
+			[CMP_GREATER] = JLTE,
+			[CMP_GREATER_EQUAL] = JLT,
+		};
+
+		bytes.resize(last_compare.start);
+		for (auto it = comments.rbegin(); it != comments.rend() && it->offset > last_compare.start; ++it)
+			it->offset = last_compare.start;
+
+		emit_load(last_compare.source1);
+		emit_load(last_compare.source2);
+		emit_jump(opcodes[last_compare.op], super_target);
+
+		last_compare.dest = nullptr;
 	}
 
 	void emit_call(value_ptr fn, std::vector<value_ptr> args, value_ptr return_value)
 	{
 		function_enter(this, "emit_call");
 
-		auto nr_args = args.size();
+		auto nr_args = args.size() + (return_value->type->size > 0);
 		if (nr_args > max_nr_args)
 			max_nr_args = nr_args;
 
@@ -625,7 +1138,7 @@ struct bytecode_function:
 
 	void emit_c_call(value_ptr fn, std::vector<value_ptr> args, value_ptr return_value)
 	{
-		auto nr_args = args.size();
+		auto nr_args = args.size() + (return_value->type->size > 0);
 		if (nr_args > max_nr_args)
 			max_nr_args = nr_args;
 
@@ -666,20 +1179,290 @@ struct bytecode_function:
 	}
 };
 
+// One instruction of pre-decoded bytecode (see run_threaded()): the
+// address of its handler and its operands, if any. 'arg' is a
+// local/argument index or the value of a constant; superinstructions
+// also use 'a' (a local index or an index into the code to jump to)
+// and 'b'/'c' (local indices).
+struct threaded_insn {
+	const void *handler;
+	uint64_t arg;
+	uint32_t a;
+	uint16_t b;
+	uint16_t c;
+};
+
+struct jit_function;
+static const void *const *run_threaded(const jit_function *fn, uint64_t *args, unsigned int nr_args);
+
 struct jit_function {
 	std::unique_ptr<uint64_t[]> constants;
 	std::unique_ptr<uint8_t[]> bytecode;
 
-	jit_function(std::shared_ptr<bytecode_function> f):
+	// Each call gets a frame with this many locals followed by this
+	// many outgoing arguments (see vm_stack).
+	unsigned int nr_locals;
+	unsigned int max_nr_args;
+
+	std::vector<threaded_insn> code;
+
+	jit_function(const ref_ptr<bytecode_function> &f):
 		constants(new uint64_t[f->constants.size()]),
-		bytecode(new uint8_t[f->bytes.size()])
+		bytecode(new uint8_t[f->bytes.size()]),
+		nr_locals(f->nr_locals),
+		max_nr_args(f->max_nr_args)
 	{
 		//printf("making jit function with bytecode at addr %p constants %p\n", &bytecode[0], &constants[0]);
 		memcpy(&constants[0], f->constants.data(), sizeof(f->constants[0]) * f->constants.size());
 		memcpy(&bytecode[0], f->bytes.data(), f->bytes.size());
+
+		// Nothing gets emitted into f after this
+		std::unordered_map<uint64_t, unsigned int>().swap(f->constant_indices);
+
+		decode(f->bytes.size());
+	}
+
+	void decode(size_t size)
+	{
+		const void *const *handlers = run_threaded(nullptr, nullptr, 0);
+
+		// Jumps go to bytecode offsets; insn_at maps them to indices
+		// into 'code' once we know where everything is
+		std::vector<uint32_t> insn_at(size);
+		std::vector<unsigned int> jumps;
+
+		size_t i = 0;
+		while (i < size) {
+			uint8_t opcode = bytecode[i];
+			assert(opcode < nr_bytecode_opcodes);
+
+			insn_at[i++] = code.size();
+			threaded_insn insn = { handlers[opcode], 0, 0, 0, 0 };
+
+			switch (opcode) {
+			case LOAD_CONSTANT:
+				insn.arg = constants[bytecode[i]];
+				i += 1;
+				break;
+			case LOAD_CONSTANT2:
+				insn.arg = constants[bytecode[i] | bytecode[i + 1] << 8];
+				i += 2;
+				break;
+			case LOAD_CONSTANT4:
+				insn.arg = constants[bytecode[i] | bytecode[i + 1] << 8 | bytecode[i + 2] << 16 | bytecode[i + 3] << 24];
+				i += 4;
+				break;
+
+			case LOAD_LOCAL:
+			case LOAD_LOCAL_ADDRESS:
+			case LOAD_ARG:
+			case STORE_LOCAL:
+				insn.arg = bytecode[i];
+				i += 1;
+				break;
+			case LOAD_LOCAL2:
+			case LOAD_LOCAL2_ADDRESS:
+			case STORE_LOCAL2:
+				insn.arg = bytecode[i] | bytecode[i + 1] << 8;
+				i += 2;
+				break;
+
+			case JUMP_REL:
+			case JUMP_IF_ZERO_REL:
+			case JEQ:
+			case JNEQ:
+			case JLT:
+			case JLTE:
+			case JGT:
+			case JGTE:
+				jumps.push_back(code.size());
+				insn.a = i - 1 + (int32_t) bytecode_u32(&bytecode[i]);
+				i += 4;
+				break;
+			case MOVE_LOCAL:
+				insn.b = bytecode_u16(&bytecode[i]);
+				insn.c = bytecode_u16(&bytecode[i + 2]);
+				i += 4;
+				break;
+			case JUMP_IF_ZERO_LOCAL:
+				jumps.push_back(code.size());
+				insn.b = bytecode_u16(&bytecode[i]);
+				insn.a = i - 1 + (int32_t) bytecode_u32(&bytecode[i + 2]);
+				i += 6;
+				break;
+			case STORE_LOCAL_PTR_OFF:
+				insn.a = bytecode_u16(&bytecode[i]);
+				insn.arg = constants[bytecode_u32(&bytecode[i + 2])];
+				i += 6;
+				break;
+
+#define _FUSED_BINOP(name, op) \
+			case name##_LLL: \
+				insn.a = bytecode_u16(&bytecode[i]); \
+				insn.b = bytecode_u16(&bytecode[i + 2]); \
+				insn.c = bytecode_u16(&bytecode[i + 4]); \
+				i += 6; \
+				break; \
+			case name##_LCL: \
+				insn.a = bytecode_u16(&bytecode[i]); \
+				insn.arg = constants[bytecode_u32(&bytecode[i + 2])]; \
+				insn.c = bytecode_u16(&bytecode[i + 6]); \
+				i += 8; \
+				break;
+
+			bytecode_fused_binop(_FUSED_BINOP)
+#undef _FUSED_BINOP
+
+#define _FUSED_COMPARE(name, op) \
+			case J##name##_LL: \
+				jumps.push_back(code.size()); \
+				insn.b = bytecode_u16(&bytecode[i]); \
+				insn.c = bytecode_u16(&bytecode[i + 2]); \
+				insn.a = i - 1 + (int32_t) bytecode_u32(&bytecode[i + 4]); \
+				i += 8; \
+				break; \
+			case J##name##_LC: \
+				jumps.push_back(code.size()); \
+				insn.b = bytecode_u16(&bytecode[i]); \
+				insn.arg = constants[bytecode_u32(&bytecode[i + 2])]; \
+				insn.a = i - 1 + (int32_t) bytecode_u32(&bytecode[i + 6]); \
+				i += 10; \
+				break;
+
+			bytecode_compare_op(_FUSED_COMPARE)
+#undef _FUSED_COMPARE
+
+			default:
+				break;
+			}
+
+			code.push_back(insn);
+		}
+
+		for (unsigned int j: jumps)
+			code[j].a = insn_at[code[j].a];
 	}
 };
 
+// Where the stack was before something was pushed on it
+struct vm_stack_mark {
+	uint64_t *top;
+	uint64_t *end;
+	unsigned int nr_chunks;
+};
+
+struct vm_frame {
+	vm_frame *caller;
+	const jit_function *fn;
+	uint64_t *args;
+
+	// Where to continue in the caller when we return (the
+	// interpreter's own idea of an instruction pointer)
+	unsigned int ret_ip;
+
+	vm_stack_mark mark;
+
+	__attribute__((always_inline))
+	uint64_t *locals()
+	{
+		return (uint64_t *) (this + 1);
+	}
+
+	__attribute__((always_inline))
+	uint64_t *new_args()
+	{
+		return locals() + fn->nr_locals;
+	}
+};
+
+static_assert(sizeof(vm_frame) % sizeof(uint64_t) == 0, "vm_frame must be a whole number of words");
+
+// The stack that bytecode functions keep their frames on. Calls don't
+// recurse in the interpreter, so the call depth is only limited by how
+// much memory we can get.
+//
+// It grows by adding chunks, not by reallocating, since we hand out
+// pointers to locals (e.g. for return values) that must stay valid.
+// Chunks that aren't in use are kept around for the next time.
+struct vm_stack {
+	struct chunk {
+		std::unique_ptr<uint64_t[]> words;
+		size_t size;
+	};
+
+	std::vector<chunk> chunks;
+
+	// chunks[nr_chunks - 1] is the one we're currently using
+	unsigned int nr_chunks;
+	uint64_t *top;
+	uint64_t *end;
+
+	vm_stack():
+		nr_chunks(0),
+		top(nullptr),
+		end(nullptr)
+	{
+	}
+
+	__attribute__((always_inline))
+	vm_stack_mark mark() const
+	{
+		return { top, end, nr_chunks };
+	}
+
+	__attribute__((always_inline))
+	void release(const vm_stack_mark &m)
+	{
+		top = m.top;
+		end = m.end;
+		nr_chunks = m.nr_chunks;
+	}
+
+	void grow(size_t n)
+	{
+		if (nr_chunks == chunks.size() || chunks[nr_chunks].size < n) {
+			size_t size = nr_chunks ? 2 * chunks[nr_chunks - 1].size : 16384;
+			while (size < n)
+				size *= 2;
+
+			chunks.resize(nr_chunks);
+			chunks.push_back({ std::unique_ptr<uint64_t[]>(new uint64_t[size]), size });
+		}
+
+		top = chunks[nr_chunks].words.get();
+		end = top + chunks[nr_chunks].size;
+		++nr_chunks;
+	}
+
+	__attribute__((always_inline))
+	vm_frame *push(vm_frame *caller, const jit_function *fn, uint64_t *args)
+	{
+		auto m = mark();
+
+		size_t n = sizeof(vm_frame) / sizeof(uint64_t) + fn->nr_locals + fn->max_nr_args;
+		if ((size_t) (end - top) < n)
+			grow(n);
+
+		auto frame = (vm_frame *) top;
+		top += n;
+
+		frame->caller = caller;
+		frame->fn = fn;
+		frame->args = args;
+		frame->ret_ip = 0;
+		frame->mark = m;
+		return frame;
+	}
+
+	__attribute__((always_inline))
+	void pop(vm_frame *frame)
+	{
+		release(frame->mark);
+	}
+};
+
+static vm_stack global_vm_stack;
+
 void disassemble_bytecode(uint64_t *constants, uint8_t *bytecode, unsigned int size, const std::vector<function_comment> &comments, unsigned int ip = 0)
 {
         auto comments_it = comments.begin();
@@ -695,8 +1478,8 @@ void disassemble_bytecode(uint64_t *constants, uint8_t *bytecode, unsigned int s
 				break;
 
 			indentation = c.indentation;
-			if (c.text.size())
-				printf("\e[33m%4s//%*.s %s\n", "", 2 * indentation, "", c.text.c_str());
+			if (c.kind != function_comment::COMMENT_INDENT)
+				printf("\e[33m%4s//%*.s %s\n", "", 2 * indentation, "", c.str().c_str());
 			++comments_it;
 		}
 
@@ -716,6 +1499,22 @@ void disassemble_bytecode(uint64_t *constants, uint8_t *bytecode, unsigned int s
 					printf(" %lu (0x%lx)\n", constants[index], constants[index]);
 				}
 				break;
+			case LOAD_CONSTANT2:
+				{
+					unsigned int index = bytecode[++i];
+					index |= bytecode[++i] << 8;
+					printf(" %lu (0x%lx)\n", constants[index], constants[index]);
+				}
+				break;
+			case LOAD_CONSTANT4:
+				{
+					unsigned int index = bytecode[++i];
+					index |= bytecode[++i] << 8;
+					index |= bytecode[++i] << 16;
+					index |= bytecode[++i] << 24;
+					printf(" %lu (0x%lx)\n", constants[index], constants[index]);
+				}
+				break;
 
 			case LOAD_LOCAL:
 			case LOAD_LOCAL_ADDRESS:
@@ -726,6 +1525,65 @@ void disassemble_bytecode(uint64_t *constants, uint8_t *bytecode, unsigned int s
 					printf(" %u\n", index);
 				}
 				break;
+			case LOAD_LOCAL2:
+			case LOAD_LOCAL2_ADDRESS:
+			case STORE_LOCAL2:
+				{
+					unsigned int index = bytecode[++i];
+					index |= bytecode[++i] << 8;
+					printf(" %u\n", index);
+				}
+				break;
+
+			case JUMP_REL:
+			case JUMP_IF_ZERO_REL:
+			case JEQ:
+			case JNEQ:
+			case JLT:
+			case JLTE:
+			case JGT:
+			case JGTE:
+				printf(" %u\n", i + (int32_t) bytecode_u32(&bytecode[i + 1]));
+				i += 4;
+				break;
+			case MOVE_LOCAL:
+				printf(" %u %u\n", bytecode_u16(&bytecode[i + 1]), bytecode_u16(&bytecode[i + 3]));
+				i += 4;
+				break;
+			case JUMP_IF_ZERO_LOCAL:
+				printf(" %u %u\n", bytecode_u16(&bytecode[i + 1]), i + (int32_t) bytecode_u32(&bytecode[i + 3]));
+				i += 6;
+				break;
+			case STORE_LOCAL_PTR_OFF:
+				printf(" %u %lu\n", bytecode_u16(&bytecode[i + 1]), constants[bytecode_u32(&bytecode[i + 3])]);
+				i += 6;
+				break;
+
+#define _FUSED_BINOP(name, op) \
+			case name##_LLL: \
+				printf(" %u %u %u\n", bytecode_u16(&bytecode[i + 1]), bytecode_u16(&bytecode[i + 3]), bytecode_u16(&bytecode[i + 5])); \
+				i += 6; \
+				break; \
+			case name##_LCL: \
+				printf(" %u %lu %u\n", bytecode_u16(&bytecode[i + 1]), constants[bytecode_u32(&bytecode[i + 3])], bytecode_u16(&bytecode[i + 7])); \
+				i += 8; \
+				break;
+
+			bytecode_fused_binop(_FUSED_BINOP)
+#undef _FUSED_BINOP
+
+#define _FUSED_COMPARE(name, op) \
+			case J##name##_LL: \
+				printf(" %u %u %u\n", bytecode_u16(&bytecode[i + 1]), bytecode_u16(&bytecode[i + 3]), i + (int32_t) bytecode_u32(&bytecode[i + 5])); \
+				i += 8; \
+				break; \
+			case J##name##_LC: \
+				printf(" %u %lu %u\n", bytecode_u16(&bytecode[i + 1]), constants[bytecode_u32(&bytecode[i + 3])], i + (int32_t) bytecode_u32(&bytecode[i + 7])); \
+				i += 10; \
+				break;
+
+			bytecode_compare_op(_FUSED_COMPARE)
+#undef _FUSED_COMPARE
 
 			default:
 				printf("\n");
@@ -752,20 +1610,19 @@ static void trace_bytecode(const char *fmt, ...)
 }
 
 template<bool debug>
-void run_bytecode(uint64_t *constants, uint8_t *bytecode,
-	uint64_t *args, unsigned int nr_args)
+void run_bytecode(const jit_function *fn, uint64_t *args, unsigned int nr_args)
 {
 	unsigned int ip = 0;
 
 	uint64_t operands[5];
 	unsigned int nr_operands = 0;
 
-	// XXX!!!!!
-	const unsigned int nr_locals = 1000;
-	const unsigned int max_nr_args = 1000;
+	vm_frame *frame = global_vm_stack.push(nullptr, fn, args);
 
-	uint64_t locals[nr_locals];
-	uint64_t new_args[max_nr_args];
+	uint64_t *constants = &fn->constants[0];
+	uint8_t *bytecode = &fn->bytecode[0];
+	uint64_t *locals = frame->locals();
+	uint64_t *new_args = frame->new_args();
 	unsigned int nr_new_args = 0;
 
 	if (debug)
@@ -799,6 +1656,15 @@ void run_bytecode(uint64_t *constants, uint8_t *bytecode,
 				operands[nr_operands++] = constants[index];
 			}
 			break;
+		case LOAD_CONSTANT4:
+			{
+				unsigned int index = bytecode[ip++];
+				index |= bytecode[ip++] << 8;
+				index |= bytecode[ip++] << 16;
+				index |= bytecode[ip++] << 24;
+				operands[nr_operands++] = constants[index];
+			}
+			break;
 
 		case LOAD_LOCAL:
 			{
@@ -874,6 +1740,14 @@ void run_bytecode(uint64_t *constants, uint8_t *bytecode,
 			}
 			nr_operands -= 1;
 			break;
+		case STORE_LOCAL2:
+			{
+				unsigned int index = bytecode[ip++];
+				index |= bytecode[ip++] << 8;
+				locals[index] = operands[nr_operands - 1];
+			}
+			nr_operands -= 1;
+			break;
 
 		// XXX: rename to just STORE?
 		case STORE_GLOBAL8:
@@ -898,6 +1772,7 @@ void run_bytecode(uint64_t *constants, uint8_t *bytecode,
 
 		case STORE_ARG:
 			assert(nr_operands >= 1);
+			assert(nr_new_args < fn->max_nr_args);
 			if (debug)
 				trace_bytecode("arg %u = 0x%lx\n", nr_new_args, operands[nr_operands - 1]);
 			new_args[nr_new_args++] = operands[nr_operands - 1];
@@ -977,23 +1852,22 @@ void run_bytecode(uint64_t *constants, uint8_t *bytecode,
 
 			// Control flow
 
-		case JUMP:
-			assert(nr_operands == 1);
-			ip = operands[0];
-			nr_operands = 0;
-			break;
-		case JUMP_IF_ZERO:
-			assert(nr_operands == 2);
-			if (!operands[1])
-				ip = operands[0];
-			nr_operands = 0;
-			break;
 		case CALL:
 			assert(nr_operands == 1);
-			{
-				auto fn = (jit_function *) operands[0];
-				run_bytecode<debug>(&fn->constants[0], &fn->bytecode[0], new_args, nr_new_args);
-			}
+
+			frame->ret_ip = ip;
+			fn = (const jit_function *) operands[0];
+			frame = global_vm_stack.push(frame, fn, new_args);
+
+			ip = 0;
+			constants = &fn->constants[0];
+			bytecode = &fn->bytecode[0];
+			args = frame->args;
+			locals = frame->locals();
+			new_args = frame->new_args();
+
+			if (debug)
+				trace_bytecode("running bytecode at addr %p with constants at addr %p\n", bytecode, constants);
 
 			nr_operands = 0;
 			nr_new_args = 0;
@@ -1009,23 +1883,421 @@ void run_bytecode(uint64_t *constants, uint8_t *bytecode,
 			nr_operands = 0;
 			nr_new_args = 0;
 			break;
+
+		case JUMP_REL:
+			assert(nr_operands == 0);
+			ip = ip - 1 + (int32_t) bytecode_u32(&bytecode[ip]);
+			break;
+		case JUMP_IF_ZERO_REL:
+			assert(nr_operands == 1);
+			nr_operands = 0;
+			if (!operands[0])
+				ip = ip - 1 + (int32_t) bytecode_u32(&bytecode[ip]);
+			else
+				ip += 4;
+			break;
+
+#define _COMPARE_JUMP(name, op) \
+		case J##name: \
+			assert(nr_operands == 2); \
+			nr_operands = 0; \
+			if (operands[0] op operands[1]) \
+				ip = ip - 1 + (int32_t) bytecode_u32(&bytecode[ip]); \
+			else \
+				ip += 4; \
+			break;
+
+		bytecode_compare_op(_COMPARE_JUMP)
+#undef _COMPARE_JUMP
+
+			// Superinstructions
+
+		case MOVE_LOCAL:
+			locals[bytecode_u16(&bytecode[ip + 2])] = locals[bytecode_u16(&bytecode[ip])];
+			ip += 4;
+			break;
+		case JUMP_IF_ZERO_LOCAL:
+			assert(nr_operands == 0);
+			if (!locals[bytecode_u16(&bytecode[ip])])
+				ip = ip - 1 + (int32_t) bytecode_u32(&bytecode[ip + 2]);
+			else
+				ip += 6;
+			break;
+		case STORE_LOCAL_PTR_OFF:
+			assert(nr_operands >= 1);
+			*(uint64_t *) (locals[bytecode_u16(&bytecode[ip])] + constants[bytecode_u32(&bytecode[ip + 2])]) = operands[nr_operands - 1];
+			nr_operands -= 1;
+			ip += 6;
+			break;
+
+#define _FUSED_BINOP(name, op) \
+		case name##_LLL: \
+			locals[bytecode_u16(&bytecode[ip + 4])] = (locals[bytecode_u16(&bytecode[ip])] op locals[bytecode_u16(&bytecode[ip + 2])]); \
+			ip += 6; \
+			break; \
+		case name##_LCL: \
+			locals[bytecode_u16(&bytecode[ip + 6])] = (locals[bytecode_u16(&bytecode[ip])] op constants[bytecode_u32(&bytecode[ip + 2])]); \
+			ip += 8; \
+			break;
+
+		bytecode_fused_binop(_FUSED_BINOP)
+#undef _FUSED_BINOP
+
+#define _FUSED_COMPARE(name, op) \
+		case J##name##_LL: \
+			assert(nr_operands == 0); \
+			if (locals[bytecode_u16(&bytecode[ip])] op locals[bytecode_u16(&bytecode[ip + 2])]) \
+				ip = ip - 1 + (int32_t) bytecode_u32(&bytecode[ip + 4]); \
+			else \
+				ip += 8; \
+			break; \
+		case J##name##_LC: \
+			assert(nr_operands == 0); \
+			if (locals[bytecode_u16(&bytecode[ip])] op constants[bytecode_u32(&bytecode[ip + 2])]) \
+				ip = ip - 1 + (int32_t) bytecode_u32(&bytecode[ip + 6]); \
+			else \
+				ip += 10; \
+			break;
+
+		bytecode_compare_op(_FUSED_COMPARE)
+#undef _FUSED_COMPARE
+
 		case RETURN:
 			assert(nr_operands == 0);
-			return;
+
+			{
+				vm_frame *caller = frame->caller;
+				global_vm_stack.pop(frame);
+				if (!caller)
+					return;
+
+				frame = caller;
+			}
+
+			fn = frame->fn;
+			ip = frame->ret_ip;
+			constants = &fn->constants[0];
+			bytecode = &fn->bytecode[0];
+			args = frame->args;
+			locals = frame->locals();
+			new_args = frame->new_args();
+			break;
 		}
 	}
 }
 
-void run_bytecode(uint64_t *constants, uint8_t *bytecode,
-	uint64_t *args, unsigned int nr_args)
+void run_bytecode(const jit_function *fn, uint64_t *args, unsigned int nr_args)
 {
 	// Do the check here and rely on the compiler to constant propagate
 	// and inline so the fast path doesn't need to check this variable
 	// more than once per eval().
 	if (global_trace_bytecode)
-		run_bytecode<true>(constants, bytecode, args, nr_args);
+		run_bytecode<true>(fn, args, nr_args);
+	else
+		run_bytecode<false>(fn, args, nr_args);
+}
+
+// Does the same as run_bytecode<false>(), but on the pre-decoded
+// instructions of a jit_function: each handler jumps straight to the
+// next one's (using GCC's labels as values) instead of going back to
+// a switch, and the top of the operand stack lives in a local variable.
+//
+// With fn == nullptr, this returns the table of handler addresses
+// (which jit_function needs to decode the bytecode).
+static const void *const *run_threaded(const jit_function *fn, uint64_t *args, unsigned int nr_args)
+{
+#define _THREADED_HANDLER(name) &&op_##name,
+	static const void *const handlers[] = {
+		bytecode_opcode(_THREADED_HANDLER)
+	};
+#undef _THREADED_HANDLER
+
+	if (!fn)
+		return handlers;
+
+	vm_frame *frame = global_vm_stack.push(nullptr, fn, args);
+
+	uint64_t *locals = frame->locals();
+	uint64_t *new_args = frame->new_args();
+	uint64_t *next_arg = new_args;
+
+	// With n operands on the stack, the top one is in 'tos' and the
+	// others are in stack[1..n-1]; sp points to stack[n]. (stack[0]
+	// just holds whatever was in 'tos' when the stack was empty.)
+	uint64_t stack[6];
+	uint64_t *sp = stack;
+	uint64_t tos = 0;
+
+	const threaded_insn *code = fn->code.data();
+	const threaded_insn *insn = code;
+
+#define NEXT() goto *(++insn)->handler
+
+	goto *insn->handler;
+
+	// Operands
+
+op_LOAD_CONSTANT:
+op_LOAD_CONSTANT2:
+op_LOAD_CONSTANT4:
+	*sp++ = tos;
+	tos = insn->arg;
+	NEXT();
+
+op_LOAD_LOCAL:
+op_LOAD_LOCAL2:
+	*sp++ = tos;
+	tos = locals[insn->arg];
+	NEXT();
+
+op_LOAD_LOCAL_ADDRESS:
+op_LOAD_LOCAL2_ADDRESS:
+	*sp++ = tos;
+	tos = (uint64_t) &locals[insn->arg];
+	NEXT();
+
+op_LOAD_GLOBAL8:
+	tos = *(uint8_t *) tos;
+	NEXT();
+op_LOAD_GLOBAL16:
+	tos = *(uint16_t *) tos;
+	NEXT();
+op_LOAD_GLOBAL32:
+	tos = *(uint32_t *) tos;
+	NEXT();
+op_LOAD_GLOBAL64:
+	tos = *(uint64_t *) tos;
+	NEXT();
+
+op_LOAD_ARG:
+	*sp++ = tos;
+	tos = args[insn->arg];
+	NEXT();
+
+op_LOAD_RET:
+	// Never emitted
+	assert(false);
+	NEXT();
+
+op_STORE_LOCAL:
+op_STORE_LOCAL2:
+	locals[insn->arg] = tos;
+	tos = *--sp;
+	NEXT();
+
+op_STORE_GLOBAL8:
+	*(uint8_t *) tos = sp[-1];
+	sp -= 2;
+	tos = *sp;
+	NEXT();
+op_STORE_GLOBAL16:
+	*(uint16_t *) tos = sp[-1];
+	sp -= 2;
+	tos = *sp;
+	NEXT();
+op_STORE_GLOBAL32:
+	*(uint32_t *) tos = sp[-1];
+	sp -= 2;
+	tos = *sp;
+	NEXT();
+op_STORE_GLOBAL64:
+	*(uint64_t *) tos = sp[-1];
+	sp -= 2;
+	tos = *sp;
+	NEXT();
+
+op_STORE_ARG:
+	*next_arg++ = tos;
+	tos = *--sp;
+	NEXT();
+
+	// Arithmetic
+
+op_ADD:
+	tos = *--sp + tos;
+	NEXT();
+op_SUB:
+	tos = *--sp - tos;
+	NEXT();
+op_MUL:
+	tos = *--sp * tos;
+	NEXT();
+op_DIV:
+	tos = *--sp / tos;
+	NEXT();
+
+	// Bitwise
+
+op_NOT:
+	--sp;
+	tos = ~tos;
+	NEXT();
+op_AND:
+	tos = *--sp & tos;
+	NEXT();
+op_OR:
+	tos = *--sp | tos;
+	NEXT();
+op_XOR:
+	tos = *--sp ^ tos;
+	NEXT();
+
+	// Relational
+
+op_EQ:
+	tos = (*--sp == tos);
+	NEXT();
+op_NEQ:
+	tos = (*--sp != tos);
+	NEXT();
+op_LT:
+	tos = (*--sp < tos);
+	NEXT();
+op_LTE:
+	tos = (*--sp <= tos);
+	NEXT();
+op_GT:
+	tos = (*--sp > tos);
+	NEXT();
+op_GTE:
+	tos = (*--sp >= tos);
+	NEXT();
+
+	// Control flow
+
+op_CALL:
+	sp = stack;
+	frame->ret_ip = insn + 1 - code;
+	fn = (const jit_function *) tos;
+	frame = global_vm_stack.push(frame, fn, new_args);
+
+	code = fn->code.data();
+	args = frame->args;
+	locals = frame->locals();
+	new_args = next_arg = frame->new_args();
+
+	insn = code;
+	goto *insn->handler;
+
+op_C_CALL:
+	sp = stack;
+	((void (*)(uint64_t *)) tos)(new_args);
+	next_arg = new_args;
+	NEXT();
+
+op_RETURN:
+	{
+		vm_frame *caller = frame->caller;
+		global_vm_stack.pop(frame);
+		if (!caller)
+			return nullptr;
+
+		frame = caller;
+	}
+
+	fn = frame->fn;
+	code = fn->code.data();
+	args = frame->args;
+	locals = frame->locals();
+	new_args = next_arg = frame->new_args();
+
+	insn = code + frame->ret_ip;
+	goto *insn->handler;
+
+op_JUMP_REL:
+	insn = &code[insn->a];
+	goto *insn->handler;
+
+op_JUMP_IF_ZERO_REL:
+	if (!tos) {
+		tos = *--sp;
+		insn = &code[insn->a];
+		goto *insn->handler;
+	}
+	tos = *--sp;
+	NEXT();
+
+#define _COMPARE_JUMP(name, op) \
+op_J##name: \
+	sp -= 2; \
+	if (sp[1] op tos) { \
+		tos = *sp; \
+		insn = &code[insn->a]; \
+		goto *insn->handler; \
+	} \
+	tos = *sp; \
+	NEXT();
+
+	bytecode_compare_op(_COMPARE_JUMP)
+#undef _COMPARE_JUMP
+
+	// Superinstructions
+
+op_MOVE_LOCAL:
+	locals[insn->c] = locals[insn->b];
+	NEXT();
+
+op_JUMP_IF_ZERO_LOCAL:
+	if (!locals[insn->b]) {
+		insn = &code[insn->a];
+		goto *insn->handler;
+	}
+	NEXT();
+
+op_STORE_LOCAL_PTR_OFF:
+	*(uint64_t *) (locals[insn->a] + insn->arg) = tos;
+	tos = *--sp;
+	NEXT();
+
+#define _FUSED_BINOP(name, op) \
+op_##name##_LLL: \
+	locals[insn->c] = (locals[insn->a] op locals[insn->b]); \
+	NEXT(); \
+op_##name##_LCL: \
+	locals[insn->c] = (locals[insn->a] op insn->arg); \
+	NEXT();
+
+	bytecode_fused_binop(_FUSED_BINOP)
+#undef _FUSED_BINOP
+
+#define _FUSED_COMPARE(name, op) \
+op_J##name##_LL: \
+	if (locals[insn->b] op locals[insn->c]) { \
+		insn = &code[insn->a]; \
+		goto *insn->handler; \
+	} \
+	NEXT(); \
+op_J##name##_LC: \
+	if (locals[insn->b] op insn->arg) { \
+		insn = &code[insn->a]; \
+		goto *insn->handler; \
+	} \
+	NEXT();
+
+	bytecode_compare_op(_FUSED_COMPARE)
+#undef _FUSED_COMPARE
+
+#undef NEXT
+}
+
+// Runs a function with whichever interpreter we're using
+static void run_jit(const jit_function *fn, uint64_t *args, unsigned int nr_args)
+{
+	// A C function that we call may throw; whatever frames it unwinds
+	// past have to go too.
+	struct release_frames {
+		vm_stack_mark mark;
+
+		~release_frames()
+		{
+			global_vm_stack.release(mark);
+		}
+	} _release_frames = { global_vm_stack.mark() };
+
+	if (global_trace_bytecode || !global_direct_threading)
+		run_bytecode(fn, args, nr_args);
 	else
-		run_bytecode<false>(constants, bytecode, args, nr_args);
+		run_threaded(fn, args, nr_args);
 }
 
 #endif
@@ -19,8 +19,6 @@
 #ifndef V_COMPILE_HH
 #define V_COMPILE_HH
 
-#include <gmpxx.h>
-
 #include "ast.hh"
 #include "ast_serializer.hh"
 #include "bytecode.hh"
@@ -45,7 +43,7 @@ struct compile_state {
 	function_ptr function;
 	scope_ptr scope;
 
-	compile_state(source_file_ptr &source, context_ptr &context, function_ptr function, scope_ptr &scope):
+	compile_state(const source_file_ptr &source, const context_ptr &context, const function_ptr &function, const scope_ptr &scope):
 		source(source),
 		context(context),
 		function(function),
@@ -59,36 +57,23 @@ struct compile_state {
 // state outside this variable!
 __thread compile_state *state;
 
-ast_node_ptr get_node(int index)
-{
-	return state->source->tree.get(index);
-}
-
-mpz_class get_literal_integer(ast_node_ptr node)
+std::string get_literal_string(ast_node_ptr node)
 {
-	assert(node->type == AST_LITERAL_INTEGER);
+	assert(node.type() == AST_LITERAL_STRING);
 
-	// TODO: parse it correctly (sign, base, etc.)...
-	mpz_class literal_integer;
-	literal_integer.set_str(std::string(&state->source->data[node->pos], node->end - node->pos), 10);
-	return literal_integer;
+	return node.string().str();
 }
 
-std::string get_literal_string(ast_node_ptr node)
+symbol_id get_symbol(ast_node_ptr node)
 {
-	assert(node->type == AST_LITERAL_STRING);
+	assert(node.type() == AST_SYMBOL_NAME);
 
-	return state->source->tree.strings[node->string_index];
+	return node.symbol();
 }
 
-std::string get_symbol_name(ast_node_ptr node)
+const std::string &get_symbol_name(ast_node_ptr node)
 {
-	assert(node->type == AST_SYMBOL_NAME);
-
-	if (node->symbol_name)
-		return node->symbol_name;
-
-	return std::string(&state->source->data[node->pos], node->end - node->pos);
+	return symbols.name(get_symbol(node));
 }
 
 template<typename... Args>
@@ -107,7 +92,7 @@ void expect(const ast_node_ptr node, bool cond, const char *fmt, Args... args)
 void expect_type(const ast_node_ptr node, ast_node_type type)
 {
 	// TODO: stringify the expected and actual types
-	expect(node, node->type == type, "got AST node type $, expected $", node->type, type);
+	expect(node, node.type() == type, "got AST node type $, expected $", node.type(), type);
 }
 
 void expect_type(const ast_node_ptr node, value_ptr value, value_type_ptr type)
@@ -116,18 +101,18 @@ void expect_type(const ast_node_ptr node, value_ptr value, value_type_ptr type)
 	expect(node, value->type == type, "unexpected type");
 }
 
-value_ptr lookup(const ast_node_ptr node, const std::string name)
+value_ptr lookup(const ast_node_ptr node, symbol_id symbol)
 {
-	scope::entry e;
-	if (!state->scope->lookup(name, e))
+	const scope::entry *e = state->scope->lookup(symbol);
+	if (!e)
 		return nullptr;
 
 	// We can always access globals
-	auto val = e.val;
+	auto val = e->val;
 	if (val->storage_type == VALUE_GLOBAL || val->storage_type == VALUE_TARGET_GLOBAL || val->storage_type == VALUE_CONSTANT)
 		return val;
 
-	if (e.f != state->function)
+	if (e->f != state->function)
 		error(node, "cannot access local variable of different function");
 
 	return val;
@@ -139,6 +124,12 @@ void use_value(const ast_node_ptr &node, value_ptr val)
 		error(node, "cannot access value at compile time");
 }
 
+static void use_value_at_compile_time(const ast_node_ptr &node, value_ptr val)
+{
+	if (!can_use_value_at_compile_time(state->context, val))
+		error(node, "cannot access value at compile time");
+}
+
 unsigned int new_object(object_ptr object)
 {
 	assert(state->objects);
@@ -151,14 +142,14 @@ struct use_function {
 	function_ptr old_function;
 	scope_ptr old_scope;
 
-	explicit use_function(function_ptr function):
+	explicit use_function(const function_ptr &function):
 		old_function(state->function),
 		old_scope(state->scope)
 	{
 		state->function = function;
 	}
 
-	use_function(function_ptr function, scope_ptr scope):
+	use_function(const function_ptr &function, const scope_ptr &scope):
 		old_function(state->function),
 		old_scope(state->scope)
 	{
@@ -176,7 +167,7 @@ struct use_function {
 struct use_scope {
 	scope_ptr old_scope;
 
-	explicit use_scope(scope_ptr scope):
+	explicit use_scope(const scope_ptr &scope):
 		old_scope(state->scope)
 	{
 		state->scope = scope;
@@ -192,7 +183,7 @@ struct use_objects {
 	objects_ptr old_objects;
 	scope_ptr old_scope;
 
-	use_objects(objects_ptr objects, scope_ptr scope):
+	use_objects(const objects_ptr &objects, const scope_ptr &scope):
 		old_objects(state->objects),
 		old_scope(state->scope)
 	{
@@ -211,7 +202,7 @@ struct use_source {
 	source_file_ptr old_source;
 	scope_ptr old_scope;
 
-	use_source(source_file_ptr source, scope_ptr scope):
+	use_source(const source_file_ptr &source, const scope_ptr &scope):
 		old_source(state->source),
 		old_scope(state->scope)
 	{
@@ -229,7 +220,7 @@ struct use_source {
 struct use_context {
 	context_ptr old_context;
 
-	explicit use_context(context_ptr context):
+	explicit use_context(const context_ptr &context):
 		old_context(state->context)
 	{
 		state->context = context;
@@ -243,9 +234,10 @@ struct use_context {
 
 static value_ptr compile(ast_node_ptr node);
 
-static void run(std::shared_ptr<bytecode_function> f)
+static void run(const ref_ptr<bytecode_function> &f)
 {
-	run_bytecode(f->constants.data(), f->bytes.data(), nullptr, 0);
+	jit_function jf(f);
+	run_jit(&jf, nullptr, 0);
 }
 
 static value_ptr eval(ast_node_ptr node)
@@ -253,10 +245,10 @@ static value_ptr eval(ast_node_ptr node)
 	if (global_trace_eval)
 		printf("\e[32m[trace-eval] %s\e[0m\n", serialize(state->source, node).c_str());
 
-	auto new_c = std::make_shared<context>(state->context);
+	auto new_c = make_ref<context>(state->context);
 	use_context _asdf(new_c);
 
-	auto new_f = std::make_shared<bytecode_function>(state->scope, new_c, true, std::vector<value_type_ptr>(), builtin_type_void);
+	auto new_f = make_ref<bytecode_function>(state->scope, new_c, true, std::vector<value_type_ptr>(), builtin_type_void);
 
 	value_ptr ret;
 	{
@@ -271,8 +263,7 @@ static value_ptr eval(ast_node_ptr node)
 			// returned value is a local (which cannot be accessed outside
 			// "new_f" itself).
 			ret = state->scope->make_value(new_c, VALUE_GLOBAL, v->type);
-			auto global = new uint8_t[v->type->size];
-			ret->global.host_address = (void *) global;
+			ret->global.host_address = state->scope->alloc_global(v->type);
 			new_f->emit_move(v, ret);
 		} else {
 			// We can return it directly
@@ -295,44 +286,44 @@ static value_ptr eval(ast_node_ptr node)
 
 static value_ptr compile_brackets(ast_node_ptr node)
 {
-	function_enter(state->function, get_source_for(state->source, node));
+	function_enter(state->function, state->source, node);
 
-	return compile(state->source->tree.get(node->unop));
+	return compile(node.unop());
 }
 
 static value_ptr compile_curly_brackets(ast_node_ptr node)
 {
-	function_enter(state->function, get_source_for(state->source, node));
+	function_enter(state->function, state->source, node);
 
 	auto ret = state->scope->make_value();
 
 	// Curly brackets create a new scope parented to the old one
-	auto new_scope = std::make_shared<scope>(state->scope);
-	auto v = (use_scope(new_scope), compile(state->source->tree.get(node->unop)));
+	scope_frame new_scope(state->scope);
+	auto v = (use_scope(new_scope.ptr()), compile(node.unop()));
 	*ret = *v;
 	return ret;
 }
 
 static value_ptr compile_member(ast_node_ptr node)
 {
-	function_enter(state->function, get_source_for(state->source, node));
+	function_enter(state->function, state->source, node);
 
-	assert(node->type == AST_MEMBER);
+	assert(node.type() == AST_MEMBER);
 
-	auto lhs = compile(state->source->tree.get(node->binop.lhs));
+	auto lhs = compile(node.lhs());
 	auto lhs_type = lhs->type;
 
-	auto rhs_node = state->source->tree.get(node->binop.rhs);
-	if (rhs_node->type != AST_SYMBOL_NAME)
+	auto rhs_node = node.rhs();
+	if (rhs_node.type() != AST_SYMBOL_NAME)
 		// TODO: say which AST node type we got instead of a symbol name
 		error(node, "member name must be a symbol");
 
-	auto symbol_name = get_symbol_name(rhs_node);
-	auto it = lhs_type->members.find(symbol_name);
-	if (it == lhs_type->members.end())
-		error(node, "unknown member: $", symbol_name);
+	auto symbol = get_symbol(rhs_node);
+	member *m = lhs_type->members.find(symbol);
+	if (!m)
+		error(node, "unknown member: $", symbols.name(symbol));
 
-	return it->second->invoke(lhs, rhs_node);
+	return m->invoke(lhs, rhs_node);
 }
 
 static value_ptr _compile_juxtapose(ast_node_ptr lhs_node, value_ptr lhs, ast_node_ptr rhs_node)
@@ -341,15 +332,13 @@ static value_ptr _compile_juxtapose(ast_node_ptr lhs_node, value_ptr lhs, ast_no
 
 	if (lhs_type == builtin_type_macro) {
 		// macros are evaluated directly
-		auto new_c = std::make_shared<context>(state->context);
-		(use_context(new_c), use_value(lhs_node, lhs));
+		use_value_at_compile_time(lhs_node, lhs);
 		assert(lhs->storage_type == VALUE_GLOBAL);
 
 		auto m = *(macro_ptr *) lhs->global.host_address;
 		return m->invoke(rhs_node);
 	} else if (lhs_type == builtin_type_type) {
-		auto new_c = std::make_shared<context>(state->context);
-		(use_context(new_c), use_value(lhs_node, lhs));
+		use_value_at_compile_time(lhs_node, lhs);
 		assert(lhs->storage_type == VALUE_GLOBAL);
 
 		// call type's constructor
@@ -361,40 +350,45 @@ static value_ptr _compile_juxtapose(ast_node_ptr lhs_node, value_ptr lhs, ast_no
 		return type->constructor(type, rhs_node);
 	}
 
-	auto it = lhs_type->members.find("_call");
-	if (it != lhs_type->members.end())
-		return it->second->invoke(lhs, rhs_node);
+	if (member *m = lhs_type->members.find(SYMBOL_CALL))
+		return m->invoke(lhs, rhs_node);
 
 	error(lhs_node, "type is not callable");
 }
 
 static value_ptr compile_juxtapose(ast_node_ptr node)
 {
-	function_enter(state->function, get_source_for(state->source, node));
+	function_enter(state->function, state->source, node);
 
-	assert(node->type == AST_JUXTAPOSE);
+	assert(node.type() == AST_JUXTAPOSE);
 
-	auto lhs_node = state->source->tree.get(node->binop.lhs);
-	auto rhs_node = state->source->tree.get(node->binop.rhs);
+	auto lhs_node = node.lhs();
+	auto rhs_node = node.rhs();
 	auto lhs = compile(lhs_node);
 	return _compile_juxtapose(lhs_node, lhs, rhs_node);
 }
 
 static value_ptr compile_symbol_name(ast_node_ptr node)
 {
-	auto symbol_name = get_symbol_name(node);
-	auto ret = lookup(node, symbol_name);
+	auto symbol = get_symbol(node);
+	auto ret = lookup(node, symbol);
 	if (!ret)
-		error(node, "could not resolve symbol: $", symbol_name);
+		error(node, "could not resolve symbol: $", symbols.name(symbol));
 
 	return ret;
 }
 
 static value_ptr compile_semicolon(ast_node_ptr node)
 {
+	// Statement lists can be very long, so we walk them in a loop
+	// instead of recursing on the tail.
 	// TODO: should we return the result of compiling LHS or void?
-	compile(state->source->tree.get(node->binop.lhs));
-	return compile(state->source->tree.get(node->binop.rhs));
+	while (node.type() == AST_SEMICOLON) {
+		compile(node.lhs());
+		node = node.rhs();
+	}
+
+	return compile(node);
 }
 
 static value_ptr builtin_type_u64_constructor(value_type_ptr, ast_node_ptr);
@@ -405,7 +399,7 @@ static value_ptr compile(ast_node_ptr node)
 	if (!node)
 		return &builtin_value_void;
 
-	switch (node->type) {
+	switch (node.type()) {
 	case AST_LITERAL_INTEGER:
 		// TODO: evaluate as int rather than u64
 		return builtin_type_u64_constructor(nullptr, node);
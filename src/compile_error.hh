@@ -43,8 +43,8 @@ struct compile_error: std::runtime_error {
 	compile_error(const source_file_ptr &source, const ast_node_ptr node, const char *fmt, Args... args):
 		std::runtime_error(format(fmt, args...)),
 		source(source),
-		pos(node->pos),
-		end(node->end)
+		pos(node.pos()),
+		end(node.end())
 	{
 		assert(end >= pos);
 	}
@@ -27,8 +27,82 @@ extern "C" {
 #include <memory>
 
 #include "format.hh"
+#include "globals.hh"
+#include "ref_ptr.hh"
+#include "source_file.hh"
+#include "symbol.hh"
 #include "value.hh"
 
+// Comments are only ever looked at by the disassembler, so we don't
+// record them unless it's going to run. Build with -DV_NO_COMMENTS to
+// compile them out altogether.
+static inline bool want_comments()
+{
+#ifdef V_NO_COMMENTS
+	return false;
+#else
+	return global_disassemble;
+#endif
+}
+
+// Comments are recorded as whatever we need to produce the text later
+// (string literals, AST nodes, symbols); they only get formatted if the
+// disassembler asks for them.
+struct function_comment {
+	enum comment_kind {
+		// Only changes the indentation
+		COMMENT_INDENT,
+		// 'text'
+		COMMENT_TEXT,
+		// 'text(args) {'
+		COMMENT_BLOCK,
+		// 'text(<source for node>) {'
+		COMMENT_SOURCE_BLOCK,
+		// 'text <symbol>'
+		COMMENT_SYMBOL,
+	};
+
+	size_t offset;
+	unsigned int indentation;
+
+	comment_kind kind;
+	const char *text;
+
+	const char *args;
+	source_file_ptr source;
+	ast_node_ptr node;
+	symbol_id symbol;
+
+	function_comment(size_t offset, unsigned int indentation, comment_kind kind, const char *text):
+		offset(offset),
+		indentation(indentation),
+		kind(kind),
+		text(text),
+		args(nullptr),
+		node(nullptr),
+		symbol(SYMBOL_NONE)
+	{
+	}
+
+	std::string str() const
+	{
+		switch (kind) {
+		case COMMENT_INDENT:
+			break;
+		case COMMENT_TEXT:
+			return text;
+		case COMMENT_BLOCK:
+			return format("$($) {", text, args);
+		case COMMENT_SOURCE_BLOCK:
+			return format("$($) {", text, get_source_for(source, node));
+		case COMMENT_SYMBOL:
+			return format("$ $", text, symbols.name(symbol));
+		}
+
+		return "";
+	}
+};
+
 struct label {
 	virtual ~label()
 	{
@@ -38,9 +112,9 @@ struct label {
 typedef std::shared_ptr<label> label_ptr;
 
 struct function;
-typedef std::shared_ptr<function> function_ptr;
+typedef ref_ptr<function> function_ptr;
 
-struct function
+struct function: refcounted
 {
 	enum compare_op {
 		CMP_EQ,
@@ -83,22 +157,37 @@ struct function
 
 	#define NOT_IMPLEMENTED not_implemented(__FILE__, __LINE__, __func__)
 
-	void comment(std::string s)
+	function_comment &add_comment(function_comment::comment_kind kind, const char *text)
 	{
-		comments.push_back(function_comment(this_object->bytes.size(), indentation, s));
+		comments.push_back(function_comment(this_object->bytes.size(), indentation, kind, text));
+		return comments.back();
 	}
 
+	void comment(const char *text)
+	{
+		if (want_comments())
+			add_comment(function_comment::COMMENT_TEXT, text);
+	}
+
+	// 'text <symbol name>'
+	void comment(const char *text, symbol_id symbol)
+	{
+		if (want_comments())
+			add_comment(function_comment::COMMENT_SYMBOL, text).symbol = symbol;
+	}
 
 	void enter()
 	{
 		++indentation;
-		comments.push_back(function_comment(this_object->bytes.size(), indentation, ""));
+		if (want_comments())
+			add_comment(function_comment::COMMENT_INDENT, "");
 	}
 
 	void leave()
 	{
 		--indentation;
-		comments.push_back(function_comment(this_object->bytes.size(), indentation, ""));
+		if (want_comments())
+			add_comment(function_comment::COMMENT_INDENT, "");
 	}
 
 	virtual void emit_prologue()
@@ -119,6 +208,14 @@ struct function
 	virtual void emit_jump_if_zero(value_ptr value, label_ptr target) = 0;
 	virtual void emit_jump(label_ptr target) = 0;
 
+	// Like emit_jump_if_zero(), but for a condition that nothing else
+	// is going to use, so a comparison that we just emitted can jump
+	// directly instead of storing its result first.
+	virtual void emit_jump_if_false(value_ptr value, label_ptr target)
+	{
+		emit_jump_if_zero(value, target);
+	}
+
 	virtual void emit_call(value_ptr target, std::vector<value_ptr> args_values, value_ptr return_value) = 0;
 	virtual void emit_c_call(value_ptr target, std::vector<value_ptr> args_values, value_ptr return_value)
 	{
@@ -134,33 +231,56 @@ struct function
 	}
 };
 
+// Brackets the code emitted while it's in scope with "name(args) {" and
+// "}" comments. 'f' is nullptr if we're not recording comments.
 struct function_block {
 	function *f;
 
-	function_block(function *f, std::string name, std::string args = ""):
-		f(f)
+	function_block(function *f, const char *name, const char *args = ""):
+		f(want_comments() ? f : nullptr)
 	{
-		f->comment(format("$($) {", name, args));
+		if (!this->f)
+			return;
+
+		f->add_comment(function_comment::COMMENT_BLOCK, name).args = args;
 		f->enter();
 	}
 
-	function_block(const function_ptr &f, std::string name, std::string args = ""):
-		f(f.get())
+	function_block(function *f, const char *name, const source_file_ptr &source, ast_node_ptr node):
+		f(want_comments() ? f : nullptr)
 	{
-		f->comment(format("$($) {", name, args));
+		if (!this->f)
+			return;
+
+		auto &c = f->add_comment(function_comment::COMMENT_SOURCE_BLOCK, name);
+		c.source = source;
+		c.node = node;
 		f->enter();
 	}
 
+	template<typename... Args>
+	function_block(const function_ptr &f, const char *name, Args... args):
+		function_block(f.get(), name, args...)
+	{
+	}
+
 	~function_block()
 	{
+		if (!f)
+			return;
+
 		f->leave();
-		f->comment("}");
+		f->add_comment(function_comment::COMMENT_TEXT, "}");
 	}
 };
 
 // This takes a weak reference on 'f', so you need to make sure it cannot be
 // destroyed before the end of the scope if you use this.
+#ifdef V_NO_COMMENTS
+#define function_enter(f, args...)
+#else
 #define function_enter(f, args...) \
 	function_block __function_enter(f, __FUNCTION__, ##args)
+#endif
 
 #endif
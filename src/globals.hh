@@ -25,7 +25,17 @@
 
 bool global_disassemble = false;
 
+// Where to cache parsed ASTs (nullptr: don't)
+const char *global_ast_cache_dir = nullptr;
+
 bool global_trace_eval = false;
 bool global_trace_bytecode = false;
 
+// Run bytecode with run_threaded() rather than the switch-based
+// run_bytecode() (which we always use for tracing)
+bool global_direct_threading = true;
+
+// Fuse common bytecode sequences (see fuse_superinstructions())
+bool global_superinstructions = true;
+
 #endif
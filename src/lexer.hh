@@ -0,0 +1,549 @@
+//
+//  V compiler
+//  Copyright (C) 2017  Vegard Nossum <vegard.nossum@gmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef V_LEXER_HH
+#define V_LEXER_HH
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+// The lexer turns the source buffer into a flat array of tokens in a
+// single pass so that the parser never has to look at the same bytes
+// more than once. Whitespace and comments are dropped; a token only
+// remembers its type and where it is in the source.
+
+enum token_type: uint8_t {
+	// Any byte that cannot start a token
+	TOKEN_UNKNOWN,
+
+	/* Atoms */
+	TOKEN_LITERAL_INTEGER,
+	TOKEN_LITERAL_STRING,
+	// A string literal that runs until the end of the buffer; we only
+	// report it if the parser actually gets to it
+	TOKEN_UNTERMINATED_STRING,
+	TOKEN_SYMBOL_NAME,
+
+	/* Outfix operators */
+	TOKEN_LEFT_PAREN,
+	TOKEN_RIGHT_PAREN,
+	TOKEN_LEFT_SQUARE_BRACKET,
+	TOKEN_RIGHT_SQUARE_BRACKET,
+	TOKEN_LEFT_CURLY_BRACKET,
+	TOKEN_RIGHT_CURLY_BRACKET,
+
+	/* Prefix operators */
+	TOKEN_AT,
+
+	/* Infix operators */
+	TOKEN_DEFINE,
+	TOKEN_MEMBER,
+	TOKEN_DECLARE,
+	TOKEN_MULTIPLY,
+	TOKEN_DIVIDE,
+	TOKEN_ADD,
+	TOKEN_SUBTRACT,
+	TOKEN_COMMA,
+	TOKEN_EQUALS,
+	TOKEN_NOTEQUALS,
+	TOKEN_LESS,
+	TOKEN_LESS_EQUAL,
+	TOKEN_GREATER,
+	TOKEN_GREATER_EQUAL,
+	TOKEN_ASSIGN,
+	TOKEN_SEMICOLON,
+
+	NR_TOKEN_TYPES,
+};
+
+struct token {
+	token_type type;
+
+	// Position in the source file
+	unsigned int pos;
+	unsigned int end;
+};
+
+// Character classes. We don't use <cctype> since that goes through the
+// locale; the source language is ASCII and anything above 0x7f is never
+// whitespace or part of a symbol.
+enum char_class: uint8_t {
+	CHAR_SPACE = 1,
+	CHAR_DIGIT = 2,
+	CHAR_ALPHA = 4,
+	CHAR_UNDERSCORE = 8,
+};
+
+struct char_class_table {
+	uint8_t classes[256];
+
+	constexpr char_class_table():
+		classes()
+	{
+		for (unsigned int c = 0; c < 256; ++c) {
+			uint8_t result = 0;
+			if (c == ' ' || (c >= '\t' && c <= '\r'))
+				result |= CHAR_SPACE;
+			if (c >= '0' && c <= '9')
+				result |= CHAR_DIGIT;
+			if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+				result |= CHAR_ALPHA;
+			if (c == '_')
+				result |= CHAR_UNDERSCORE;
+
+			classes[c] = result;
+		}
+	}
+
+	bool is(char c, uint8_t mask) const
+	{
+		return classes[(unsigned char) c] & mask;
+	}
+};
+
+static constexpr char_class_table char_classes;
+
+// Scanners return the position of the first byte at or after 'pos' that
+// is not in the given character class. We have a plain version which looks
+// at one byte at a time and versions which look at 16 (SSE2) or 32 (AVX2)
+// bytes at a time; the best one is picked at startup based on what the
+// CPU supports.
+typedef unsigned int (*scan_fn)(const char *buf, unsigned int pos, unsigned int len);
+
+template<uint8_t mask>
+unsigned int scan_scalar(const char *buf, unsigned int pos, unsigned int len)
+{
+	unsigned int i = pos;
+
+	while (i < len && char_classes.is(buf[i], mask))
+		++i;
+
+	return i;
+}
+
+#ifdef __x86_64__
+// Bytes are compared as signed, which means that anything above 0x7f is
+// negative and never in range.
+static inline __m128i sse2_in_range(__m128i x, char lo, char hi)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8(hi + 1)));
+}
+
+template<uint8_t mask>
+static inline __m128i sse2_classify(__m128i x)
+{
+	__m128i result = _mm_setzero_si128();
+
+	if (mask & CHAR_SPACE) {
+		result = _mm_or_si128(result, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+		result = _mm_or_si128(result, sse2_in_range(x, '\t', '\r'));
+	}
+	if (mask & CHAR_DIGIT)
+		result = _mm_or_si128(result, sse2_in_range(x, '0', '9'));
+	// Setting bit 5 maps upper case to lower case, and nothing else
+	// into the range of lower case letters
+	if (mask & CHAR_ALPHA)
+		result = _mm_or_si128(result, sse2_in_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z'));
+	if (mask & CHAR_UNDERSCORE)
+		result = _mm_or_si128(result, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+
+	return result;
+}
+
+template<uint8_t mask>
+unsigned int scan_sse2(const char *buf, unsigned int pos, unsigned int len)
+{
+	unsigned int i = pos;
+
+	while (i + 16 <= len) {
+		__m128i x = _mm_loadu_si128((const __m128i *) &buf[i]);
+		unsigned int m = ~_mm_movemask_epi8(sse2_classify<mask>(x)) & 0xffff;
+		if (m)
+			return i + __builtin_ctz(m);
+
+		i += 16;
+	}
+
+	return scan_scalar<mask>(buf, i, len);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_in_range(__m256i x, char lo, char hi)
+{
+	return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(lo - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), x));
+}
+
+template<uint8_t mask>
+__attribute__((target("avx2")))
+static inline __m256i avx2_classify(__m256i x)
+{
+	__m256i result = _mm256_setzero_si256();
+
+	if (mask & CHAR_SPACE) {
+		result = _mm256_or_si256(result, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+		result = _mm256_or_si256(result, avx2_in_range(x, '\t', '\r'));
+	}
+	if (mask & CHAR_DIGIT)
+		result = _mm256_or_si256(result, avx2_in_range(x, '0', '9'));
+	if (mask & CHAR_ALPHA)
+		result = _mm256_or_si256(result, avx2_in_range(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z'));
+	if (mask & CHAR_UNDERSCORE)
+		result = _mm256_or_si256(result, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+
+	return result;
+}
+
+template<uint8_t mask>
+__attribute__((target("avx2")))
+unsigned int scan_avx2(const char *buf, unsigned int pos, unsigned int len)
+{
+	unsigned int i = pos;
+
+	while (i + 32 <= len) {
+		__m256i x = _mm256_loadu_si256((const __m256i *) &buf[i]);
+		unsigned int m = ~(unsigned int) _mm256_movemask_epi8(avx2_classify<mask>(x));
+		if (m)
+			return i + __builtin_ctz(m);
+
+		i += 32;
+	}
+
+	return scan_sse2<mask>(buf, i, len);
+}
+#endif
+
+struct lexer_scanners {
+	const char *name;
+
+	scan_fn whitespace;
+	scan_fn symbol_name;
+	scan_fn digits;
+};
+
+static const lexer_scanners scalar_scanners = {
+	"scalar",
+	scan_scalar<CHAR_SPACE>,
+	scan_scalar<CHAR_ALPHA | CHAR_DIGIT | CHAR_UNDERSCORE>,
+	scan_scalar<CHAR_DIGIT>,
+};
+
+#ifdef __x86_64__
+static const lexer_scanners sse2_scanners = {
+	"sse2",
+	scan_sse2<CHAR_SPACE>,
+	scan_sse2<CHAR_ALPHA | CHAR_DIGIT | CHAR_UNDERSCORE>,
+	scan_sse2<CHAR_DIGIT>,
+};
+
+static const lexer_scanners avx2_scanners = {
+	"avx2",
+	scan_avx2<CHAR_SPACE>,
+	scan_avx2<CHAR_ALPHA | CHAR_DIGIT | CHAR_UNDERSCORE>,
+	scan_avx2<CHAR_DIGIT>,
+};
+#endif
+
+static const lexer_scanners *detect_scanners()
+{
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &avx2_scanners;
+
+	// SSE2 is part of the x86-64 baseline
+	return &sse2_scanners;
+#else
+	return &scalar_scanners;
+#endif
+}
+
+static const lexer_scanners *default_scanners = detect_scanners();
+
+struct lexer {
+	const char *buf;
+	unsigned int len;
+
+	const lexer_scanners *scanners;
+
+	lexer(const char *buf, size_t len, const lexer_scanners *scanners = default_scanners):
+		buf(buf),
+		len(len),
+		scanners(scanners)
+	{
+	}
+
+	template<uint8_t mask>
+	unsigned int scan(scan_fn scanner, unsigned int pos);
+
+	void skip_whitespace(unsigned int &pos);
+	void skip_comments(unsigned int &pos);
+	void skip_whitespace_and_comments(unsigned int &pos);
+
+	unsigned int scan_literal_integer(unsigned int pos);
+	unsigned int scan_literal_string(unsigned int pos, token_type &type);
+	unsigned int scan_symbol_name(unsigned int pos);
+
+	void tokenize(std::vector<token> &tokens);
+};
+
+// Most runs of whitespace, digits, etc. are short, so we look at the
+// first few bytes here before calling out to the vectorised scanner.
+template<uint8_t mask>
+unsigned int lexer::scan(scan_fn scanner, unsigned int pos)
+{
+	unsigned int i = pos;
+
+	for (unsigned int n = 0; n < 4; ++n) {
+		if (i == len || !char_classes.is(buf[i], mask))
+			return i;
+
+		++i;
+	}
+
+	return scanner(buf, i, len);
+}
+
+void lexer::skip_whitespace(unsigned int &pos)
+{
+	pos = scan<CHAR_SPACE>(scanners->whitespace, pos);
+}
+
+void lexer::skip_comments(unsigned int &pos)
+{
+	unsigned int i = pos;
+
+	if (i < len && buf[i] == '#') {
+		++i;
+
+		// memchr() already uses the widest vector instructions
+		// that the CPU supports
+		auto newline = (const char *) memchr(&buf[i], '\n', len - i);
+		if (newline)
+			i = newline - buf + 1;
+		else
+			i = len;
+	}
+
+	pos = i;
+}
+
+void lexer::skip_whitespace_and_comments(unsigned int &pos)
+{
+	unsigned int i = pos;
+
+	while (true) {
+		skip_whitespace(i);
+		skip_comments(i);
+
+		if (i == len)
+			break;
+
+		// If we didn't skip anything, we should stop
+		if (i == pos)
+			break;
+
+		pos = i;
+	}
+
+	pos = i;
+}
+
+unsigned int lexer::scan_literal_integer(unsigned int pos)
+{
+	unsigned int i = pos;
+
+	// TODO: this rejects hex digits, but if we use isxdigit() it
+	// will consume non-numbers
+
+	i = scan<CHAR_DIGIT>(scanners->digits, i);
+
+	if (i < len) {
+		if (buf[i] == 'b') {
+			++i;
+		} else if (buf[i] == 'h') {
+			++i;
+		} else if (buf[i] == 'o') {
+			++i;
+		} else if (buf[i] == 'd') {
+			++i;
+		}
+	}
+
+	return i;
+}
+
+unsigned int lexer::scan_literal_string(unsigned int pos, token_type &type)
+{
+	unsigned int i = pos;
+
+	assert(buf[i] == '\"');
+	++i;
+
+	while (i < len && buf[i] != '\"') {
+		if (buf[i] == '\\') {
+			++i;
+			if (i == len)
+				break;
+		}
+
+		++i;
+	}
+
+	if (i == len) {
+		type = TOKEN_UNTERMINATED_STRING;
+		return i;
+	}
+
+	type = TOKEN_LITERAL_STRING;
+	return i + 1;
+}
+
+unsigned int lexer::scan_symbol_name(unsigned int pos)
+{
+	return scan<CHAR_ALPHA | CHAR_DIGIT | CHAR_UNDERSCORE>(scanners->symbol_name, pos);
+}
+
+void lexer::tokenize(std::vector<token> &tokens)
+{
+	unsigned int i = 0;
+
+	skip_whitespace_and_comments(i);
+
+	while (i < len) {
+		token_type type = TOKEN_UNKNOWN;
+		unsigned int end = i + 1;
+
+		// Dispatch on the first byte; for operators that are a prefix
+		// of another operator we always take the longest match.
+		switch (buf[i]) {
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			type = TOKEN_LITERAL_INTEGER;
+			end = scan_literal_integer(i);
+			break;
+
+		case '\"':
+			end = scan_literal_string(i, type);
+			break;
+
+		case '(':
+			type = TOKEN_LEFT_PAREN;
+			break;
+		case ')':
+			type = TOKEN_RIGHT_PAREN;
+			break;
+		case '[':
+			type = TOKEN_LEFT_SQUARE_BRACKET;
+			break;
+		case ']':
+			type = TOKEN_RIGHT_SQUARE_BRACKET;
+			break;
+		case '{':
+			type = TOKEN_LEFT_CURLY_BRACKET;
+			break;
+		case '}':
+			type = TOKEN_RIGHT_CURLY_BRACKET;
+			break;
+
+		case '@':
+			type = TOKEN_AT;
+			break;
+
+		case '.':
+			type = TOKEN_MEMBER;
+			break;
+		case ':':
+			if (end < len && buf[end] == '=') {
+				type = TOKEN_DEFINE;
+				++end;
+			} else {
+				type = TOKEN_DECLARE;
+			}
+			break;
+		case '*':
+			type = TOKEN_MULTIPLY;
+			break;
+		case '/':
+			type = TOKEN_DIVIDE;
+			break;
+		case '+':
+			type = TOKEN_ADD;
+			break;
+		case '-':
+			type = TOKEN_SUBTRACT;
+			break;
+		case ',':
+			type = TOKEN_COMMA;
+			break;
+		case '=':
+			if (end < len && buf[end] == '=') {
+				type = TOKEN_EQUALS;
+				++end;
+			} else {
+				type = TOKEN_ASSIGN;
+			}
+			break;
+		case '!':
+			if (end < len && buf[end] == '=') {
+				type = TOKEN_NOTEQUALS;
+				++end;
+			}
+			break;
+		case '<':
+			if (end < len && buf[end] == '=') {
+				type = TOKEN_LESS_EQUAL;
+				++end;
+			} else {
+				type = TOKEN_LESS;
+			}
+			break;
+		case '>':
+			if (end < len && buf[end] == '=') {
+				type = TOKEN_GREATER_EQUAL;
+				++end;
+			} else {
+				type = TOKEN_GREATER;
+			}
+			break;
+		case ';':
+			type = TOKEN_SEMICOLON;
+			break;
+
+		default:
+			if (char_classes.is(buf[i], CHAR_ALPHA | CHAR_UNDERSCORE)) {
+				type = TOKEN_SYMBOL_NAME;
+				end = scan_symbol_name(i);
+			}
+			break;
+		}
+
+		tokens.push_back(token { type, i, end });
+
+		i = end;
+		skip_whitespace_and_comments(i);
+	}
+}
+
+#endif
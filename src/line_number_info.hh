@@ -20,28 +20,41 @@
 #define V_LINE_NUMBER_INFO_HH
 
 #include <cassert>
-#include <cstdio>
-#include <cstdlib>
+#include <cstdint>
 #include <cstring>
-#include <map>
-#include <algorithm>
-#include <sstream>
+#include <vector>
 
+// Maps byte offsets to line numbers. We keep the offset at which each line
+// starts in a sorted array; the last entry is the end of the buffer (it
+// doesn't start a real line, but lookups at EOF end up there).
 struct line_number_info {
-	std::map<unsigned int, unsigned int> byte_offset_to_line_number_map;
+	const char *buf;
+	std::vector<uint32_t> line_starts;
 
-	line_number_info(const char *buf, size_t len)
+	line_number_info(const char *buf, size_t len):
+		buf(buf)
 	{
-		unsigned int current_line = 1;
+		// Lines are usually a few dozen bytes; avoid growing the
+		// array too many times for big files
+		line_starts.reserve(len / 32 + 2);
 
-		for (unsigned int i = 0; i < len; ++i) {
-			byte_offset_to_line_number_map.insert(std::make_pair(i, current_line++));
+		if (len)
+			line_starts.push_back(0);
 
-			while (i < len && buf[i] != '\n')
-				++i;
+		// memchr() is vectorised, which is what we want for the
+		// typical line length
+		const char *p = buf;
+		const char *end = buf + len;
+		while (true) {
+			auto newline = (const char *) memchr(p, '\n', end - p);
+			if (!newline || newline + 1 == end)
+				break;
+
+			p = newline + 1;
+			line_starts.push_back(p - buf);
 		}
 
-		byte_offset_to_line_number_map.insert(std::make_pair(len, current_line));
+		line_starts.push_back(len);
 	}
 
 	struct lookup_result {
@@ -54,21 +67,44 @@ struct line_number_info {
 
 	struct lookup_result lookup(unsigned int byte_offset) const
 	{
-		auto it = byte_offset_to_line_number_map.upper_bound(byte_offset);
-		if (it == byte_offset_to_line_number_map.begin())
-			return lookup_result{0, 0, 0, 0};
+		// Find the last line starting at or before byte_offset;
+		// the loop has no data-dependent branches, just a
+		// conditional move
+		const uint32_t *base = line_starts.data();
+		size_t n = line_starts.size();
+		while (n > 1) {
+			size_t half = n / 2;
+			base = (base[half] <= byte_offset) ? base + half : base;
+			n -= half;
+		}
 
-		auto it2 = it;
-		--it;
+		// line_starts[0] is always 0
+		assert(*base <= byte_offset);
 
-		assert(byte_offset >= it->first);
+		const uint32_t *next = base + 1;
 		return lookup_result{
-			it->first,
-			it2->first - it->first,
-			it->second,
-			byte_offset - it->first,
+			*base,
+			next < line_starts.data() + line_starts.size() ? *next - *base : 0,
+			(unsigned int) (base - line_starts.data()) + 1,
+			byte_offset - *base,
 		};
 	}
+
+	// Like lookup().column, but counting UTF-8 characters rather than
+	// bytes (which is what you want when lining things up on a terminal)
+	unsigned int utf8_column(unsigned int byte_offset) const
+	{
+		auto pos = lookup(byte_offset);
+
+		unsigned int result = 0;
+		for (unsigned int i = pos.line_start; i < byte_offset; ++i) {
+			// Skip continuation bytes
+			if (((unsigned char) buf[i] & 0xc0) != 0x80)
+				++result;
+		}
+
+		return result;
+	}
 };
 
 #endif
@@ -21,7 +21,12 @@ extern "C" {
 #include <sys/types.h>
 }
 
+#include <atomic>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <thread>
 
 #include "ast.hh"
 #include "ast_serializer.hh"
@@ -65,8 +70,8 @@ static void _print_u64(uint64_t *args)
 
 static void _print_str(uint64_t *args)
 {
-	auto s = *(std::string *) args[0];
-	printf("%s\n", s.c_str());
+	auto s = (const str_view *) args[0];
+	printf("%.*s\n", (int) s->length, s->data);
 }
 
 static value_ptr builtin_macro_print(ast_node_ptr node)
@@ -83,8 +88,7 @@ static value_ptr builtin_macro_print(ast_node_ptr node)
 		auto print_fn = state->scope->make_value(state->context, VALUE_CONSTANT, builtin_type_u64);
 		print_fn->constant.u64 = (uint64_t) &_print_str;
 
-		// TODO: I think this only works by pure coincidence,
-		// the problem is we're passing (part of) a std::string as char *
+		// str is bigger than a register, so it gets passed by address
 		use_value(node, arg);
 		state->function->emit_c_call(print_fn, { arg }, &builtin_value_void);
 	} else {
@@ -101,17 +105,17 @@ static auto builtin_value_namespace_lang = new value(nullptr, VALUE_CONSTANT,
 		.constructor = nullptr,
 		.argument_types = std::vector<value_type_ptr>(),
 		.return_type = nullptr,
-		.members = std::map<std::string, member_ptr>({
-			{"macro", std::make_shared<namespace_member>(builtin_type_macro)},
-			{"scope", std::make_shared<namespace_member>(builtin_type_scope)},
-			{"value", std::make_shared<namespace_member>(builtin_type_value)},
+		.members = member_table({
+			{symbols.intern("macro"), std::make_shared<namespace_member>(builtin_type_macro)},
+			{symbols.intern("scope"), std::make_shared<namespace_member>(builtin_type_scope)},
+			{symbols.intern("value"), std::make_shared<namespace_member>(builtin_type_value)},
 		}),
 	})
 );
 
 static scope_ptr make_toplevel_scope()
 {
-	auto global_scope = std::make_shared<scope>();
+	auto global_scope = make_ref<scope>();
 
 	// Namespaces
 	global_scope->define_builtin_namespace("lang", builtin_value_namespace_lang);
@@ -153,10 +157,10 @@ static scope_ptr make_toplevel_scope()
 	return global_scope;
 }
 
-static std::shared_ptr<bytecode_function> compile_metaprogram(scope_ptr scope, source_file_ptr source, ast_node_ptr root)
+static ref_ptr<bytecode_function> compile_metaprogram(const scope_ptr &scope, const source_file_ptr &source, ast_node_ptr root)
 {
-	auto c = std::make_shared<context>(nullptr);
-	auto f = std::make_shared<bytecode_function>(scope, c, true, std::vector<value_type_ptr>(), builtin_type_void);
+	auto c = make_ref<context>(nullptr);
+	auto f = make_ref<bytecode_function>(scope, c, true, std::vector<value_type_ptr>(), builtin_type_void);
 	compile_state new_state(source, c, f, scope);
 	state = &new_state;
 
@@ -169,24 +173,38 @@ static std::shared_ptr<bytecode_function> compile_metaprogram(scope_ptr scope, s
 }
 
 static bool do_dump_ast = false;
+static bool do_dump_ast_jsonl = false;
+static bool do_dump_ast_stats = false;
 static bool do_compile = true;
 static bool do_run = true;
 
-static bool compile_and_run(source_file_ptr source)
+// 'root' is the result of source->parse(); it may come from another
+// thread (see parse_pool), so we only wait for it here, where we can
+// report any parse errors in order.
+static bool compile_and_run(source_file_ptr source, std::future<int> root)
 {
 	auto scope = make_toplevel_scope();
 
 	try {
-		auto node = source->parse();
+		auto node = root.get();
 		assert(node != -1);
 
-		std::shared_ptr<bytecode_function> f;
+		if (do_dump_ast_stats) {
+			const ast_tree &tree = source->tree;
+			printf("ast: %u live nodes, %u allocated (%zu bytes)\n",
+				tree.count_live(node), tree.size(),
+				tree.size() * (sizeof(ast_node_type) + sizeof(ast_span) + sizeof(ast_children)));
+		}
+
+		ref_ptr<bytecode_function> f;
 
 		if (do_compile)
 			f = compile_metaprogram(scope, source, source->tree.get(node));
 
 		if (do_dump_ast)
-			printf("%s\n", serialize(source, source->tree.get(node)).c_str());
+			serialize(stdout, source, source->tree.get(node));
+		if (do_dump_ast_jsonl)
+			serialize_jsonl(stdout, source, source->tree.get(node));
 
 		if (global_disassemble) {
 			printf("metaprogram:\n");
@@ -207,10 +225,67 @@ static bool compile_and_run(source_file_ptr source)
 	return false;
 }
 
+// Parses a list of source files on a number of worker threads, in
+// order. Parsing doesn't depend on anything but the source (and the
+// symbol table, which does its own locking), so this lets us get ahead
+// while the main thread compiles and runs the files one by one.
+struct parse_pool {
+	const std::vector<source_file_ptr> &sources;
+	std::vector<std::promise<int>> roots;
+	std::vector<std::future<int>> futures;
+
+	std::atomic<unsigned int> next;
+	std::atomic<bool> stop;
+	std::vector<std::thread> threads;
+
+	parse_pool(const std::vector<source_file_ptr> &sources, unsigned int nr_threads):
+		sources(sources),
+		roots(sources.size()),
+		next(0),
+		stop(false)
+	{
+		for (auto &root: roots)
+			futures.push_back(root.get_future());
+
+		symbols.concurrent = true;
+
+		for (unsigned int i = 0; i < nr_threads; ++i)
+			threads.push_back(std::thread(&parse_pool::work, this));
+	}
+
+	~parse_pool()
+	{
+		// Don't bother with the files we haven't started on yet
+		stop = true;
+
+		for (auto &thread: threads)
+			thread.join();
+	}
+
+	void work()
+	{
+		while (!stop) {
+			unsigned int i = next++;
+			if (i >= sources.size())
+				break;
+
+			try {
+				roots[i].set_value(sources[i]->parse());
+			} catch (...) {
+				roots[i].set_exception(std::current_exception());
+			}
+		}
+	}
+};
+
 static void repl()
 {
 	auto scope = make_toplevel_scope();
 
+	// Anything defined on one line may still refer to that line's AST
+	// (and string literals) later on, so we can't let go of them
+	std::vector<source_file_ptr> sources;
+
 	// TODO: use std::cin or something that doesn't limit line length
 	static char line[1024];
 	while (true) {
@@ -220,7 +295,9 @@ static void repl()
 		if (!fgets(line, sizeof(line), stdin))
 			break;
 
-		auto source = std::make_shared<source_file>("<stdin>", line, strlen(line));
+		auto source = make_ref<string_source_file>("<stdin>", line);
+		sources.push_back(source);
+
 		try {
 			auto node = source->parse();
 			assert(node != -1);
@@ -238,24 +315,68 @@ static void repl()
 	fflush(stdout);
 }
 
+// Not getrusage(): ru_maxrss includes whatever the process used before
+// it exec()ed us, which for a shell with a long command line is a lot.
+static void report_rss()
+{
+	FILE *f = fopen("/proc/self/status", "r");
+	if (!f)
+		return;
+
+	char line[256];
+	long kb;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) {
+			fprintf(stderr, "peak rss: %ld kB\n", kb);
+			break;
+		}
+	}
+
+	fclose(f);
+}
+
 int main(int argc, char *argv[])
 {
 	std::vector<const char *> filenames;
+	unsigned int nr_jobs = 1;
 
 	for (int i = 1; i < argc; ++i) {
 		if (argv[i][0] == '-') {
 			if (!strcmp(argv[i], "--dump-ast"))
 				do_dump_ast = true;
+			else if (!strcmp(argv[i], "--dump-ast-jsonl"))
+				do_dump_ast_jsonl = true;
+			else if (!strcmp(argv[i], "--dump-ast-stats"))
+				do_dump_ast_stats = true;
 			else if (!strcmp(argv[i], "--no-compile"))
 				do_compile = false;
 			else if (!strcmp(argv[i], "--no-run"))
 				do_run = false;
-			else if (!strcmp(argv[i], "--disassemble"))
+			else if (!strncmp(argv[i], "--ast-cache=", strlen("--ast-cache=")))
+				global_ast_cache_dir = argv[i] + strlen("--ast-cache=");
+			else if (!strncmp(argv[i], "-j", 2)) {
+				const char *arg = argv[i][2] ? &argv[i][2] : argv[++i];
+				if (!arg)
+					error(EXIT_FAILURE, 0, "Invalid number of jobs: ");
+
+				char *end;
+				long value = strtol(arg, &end, 10);
+				if (end == arg || *end || value < 1 || value > INT_MAX)
+					error(EXIT_FAILURE, 0, "Invalid number of jobs: %s", arg);
+
+				nr_jobs = value;
+			} else if (!strcmp(argv[i], "--disassemble"))
 				global_disassemble = true;
 			else if (!strcmp(argv[i], "-Xtrace-eval"))
 				global_trace_eval = true;
 			else if (!strcmp(argv[i], "-Xtrace-bytecode"))
 				global_trace_bytecode = true;
+			else if (!strcmp(argv[i], "-Xno-direct-threading"))
+				global_direct_threading = false;
+			else if (!strcmp(argv[i], "-Xno-superinstructions"))
+				global_superinstructions = false;
+			else if (!strcmp(argv[i], "-Xreport-rss"))
+				atexit(report_rss);
 			else
 				error(EXIT_FAILURE, 0, "Unrecognised option: %s", argv[i]);
 		} else {
@@ -265,11 +386,32 @@ int main(int argc, char *argv[])
 
 	if (filenames.empty()) {
 		repl();
-	} else {
+	} else if (nr_jobs == 1) {
 		for (const char *filename: filenames) {
-			auto source = std::make_shared<mmap_source_file>(filename);
-			if (compile_and_run(source))
+			auto source = make_ref<mmap_source_file>(filename);
+			auto root = std::async(std::launch::deferred, [source]() {
+				return source->parse();
+			});
+
+			if (compile_and_run(source, std::move(root)))
+				return EXIT_FAILURE;
+		}
+	} else {
+		// All output happens on this thread, in the order the files
+		// were given, so it doesn't matter in which order (or on which
+		// thread) the files were parsed.
+		std::vector<source_file_ptr> sources;
+		for (const char *filename: filenames)
+			sources.push_back(make_ref<mmap_source_file>(filename));
+
+		parse_pool pool(sources, std::min<size_t>(nr_jobs, sources.size()));
+		for (unsigned int i = 0; i < sources.size(); ++i) {
+			if (compile_and_run(sources[i], std::move(pool.futures[i])))
 				return EXIT_FAILURE;
+
+			// Don't keep every file mapped until we exit. The parser
+			// threads are done with it since we got its root.
+			sources[i].reset();
 		}
 	}
 
@@ -59,19 +59,6 @@ struct relocation {
 	}
 };
 
-struct function_comment {
-	size_t offset;
-	unsigned int indentation;
-	std::string text;
-
-	function_comment(size_t offset, unsigned int indentation, std::string text):
-		offset(offset),
-		indentation(indentation),
-		text(text)
-	{
-	}
-};
-
 struct object;
 typedef std::shared_ptr<object> object_ptr;
 
@@ -29,6 +29,7 @@
 #include <vector>
 
 #include "ast.hh"
+#include "lexer.hh"
 
 /*
  * Nullary/unary (outfix) operators:
@@ -116,422 +117,560 @@ struct syntax_error: parse_error {
 	}
 };
 
+// Binary operators, indexed by token type. Operators that are parsed as a
+// call to a built-in macro have a symbol name; the rest get their own AST
+// node type.
+struct binop {
+	token_type token;
+	ast_node_type type;
+	precedence prec;
+	associativity assoc;
+	bool allow_trailing;
+	symbol_id symbol;
+};
+
+/* We want comma and semicolon lists to behave like they typically do in
+ * lisp, scheme, etc. where you have the head of the list as the first
+ * operand and then the rest of it as the second operand; therefore they
+ * should right associative. The same goes for juxtaposition. */
+static const binop binops[] = {
+	{ TOKEN_UNKNOWN },
+	{ TOKEN_LITERAL_INTEGER },
+	{ TOKEN_LITERAL_STRING },
+	{ TOKEN_UNTERMINATED_STRING },
+	{ TOKEN_SYMBOL_NAME },
+	{ TOKEN_LEFT_PAREN },
+	{ TOKEN_RIGHT_PAREN },
+	{ TOKEN_LEFT_SQUARE_BRACKET },
+	{ TOKEN_RIGHT_SQUARE_BRACKET },
+	{ TOKEN_LEFT_CURLY_BRACKET },
+	{ TOKEN_RIGHT_CURLY_BRACKET },
+	{ TOKEN_AT },
+	{ TOKEN_DEFINE, AST_JUXTAPOSE, PREC_DEFINE, ASSOC_LEFT, false, SYMBOL_DEFINE },
+	{ TOKEN_MEMBER, AST_MEMBER, PREC_MEMBER, ASSOC_LEFT, false, SYMBOL_NONE },
+	{ TOKEN_DECLARE, AST_JUXTAPOSE, PREC_PAIR, ASSOC_LEFT, false, SYMBOL_DECLARE },
+	{ TOKEN_MULTIPLY, AST_JUXTAPOSE, PREC_MULTIPLY_DIVIDE, ASSOC_LEFT, false, SYMBOL_MULTIPLY },
+	{ TOKEN_DIVIDE, AST_JUXTAPOSE, PREC_MULTIPLY_DIVIDE, ASSOC_LEFT, false, SYMBOL_DIVIDE },
+	{ TOKEN_ADD, AST_JUXTAPOSE, PREC_ADD_SUBTRACT, ASSOC_LEFT, false, SYMBOL_ADD },
+	{ TOKEN_SUBTRACT, AST_JUXTAPOSE, PREC_ADD_SUBTRACT, ASSOC_LEFT, false, SYMBOL_SUBTRACT },
+	{ TOKEN_COMMA, AST_COMMA, PREC_COMMA, ASSOC_RIGHT, true, SYMBOL_NONE },
+	{ TOKEN_EQUALS, AST_JUXTAPOSE, PREC_EQUALITY, ASSOC_LEFT, false, SYMBOL_EQUALS },
+	{ TOKEN_NOTEQUALS, AST_JUXTAPOSE, PREC_EQUALITY, ASSOC_LEFT, false, SYMBOL_NOTEQUALS },
+	{ TOKEN_LESS, AST_JUXTAPOSE, PREC_EQUALITY, ASSOC_LEFT, false, SYMBOL_LESS },
+	{ TOKEN_LESS_EQUAL, AST_JUXTAPOSE, PREC_EQUALITY, ASSOC_LEFT, false, SYMBOL_LESS_EQUAL },
+	{ TOKEN_GREATER, AST_JUXTAPOSE, PREC_EQUALITY, ASSOC_LEFT, false, SYMBOL_GREATER },
+	{ TOKEN_GREATER_EQUAL, AST_JUXTAPOSE, PREC_EQUALITY, ASSOC_LEFT, false, SYMBOL_GREATER_EQUAL },
+	{ TOKEN_ASSIGN, AST_JUXTAPOSE, PREC_ASSIGN, ASSOC_LEFT, false, SYMBOL_ASSIGN },
+	{ TOKEN_SEMICOLON, AST_SEMICOLON, PREC_SEMICOLON, ASSOC_RIGHT, true, SYMBOL_NONE },
+};
+
+static_assert(sizeof(binops) / sizeof(*binops) == NR_TOKEN_TYPES,
+	"every token type needs an entry in the binary operator table");
+
+// Juxtaposition doesn't have an operator token
+static const binop juxtapose_binop = {
+	TOKEN_UNKNOWN, AST_JUXTAPOSE, PREC_JUXTAPOSE, ASSOC_RIGHT, false, SYMBOL_NONE
+};
+
+// Anything that the parser is in the middle of parsing lives on an
+// explicit stack rather than on the C++ call stack, so that deeply nested
+// input (including long lists of statements, which are right associative
+// chains of semicolons) doesn't turn into deep recursion.
+struct parser_frame {
+	enum frame_kind {
+		// An expression. 'lhs' is -1 until we have parsed its first
+		// operand; after that, 'op' is waiting for its right hand side.
+		FRAME_EXPR,
+		// Outfix operator waiting for its operand and terminator
+		FRAME_OUTFIX,
+		// Prefix operator waiting for its operand
+		FRAME_PREFIX,
+	};
+
+	frame_kind kind;
+
+	// Index of the operator token
+	unsigned int op_index;
+
+	union {
+		struct {
+			unsigned int min_precedence;
+			int lhs;
+			const binop *op;
+		} expr;
+
+		struct {
+			ast_node_type type;
+			token_type right;
+		} outfix;
+
+		symbol_id symbol;
+	};
+};
+
 struct parser {
 	const char *buf;
 	unsigned int len;
 
 	ast_tree &tree;
 
+	std::vector<token> tokens;
+	unsigned int nr_tokens;
+
 	parser(const char *buf, size_t len, ast_tree &tree):
 		buf(buf),
 		len(len),
 		tree(tree)
 	{
+		tree.source = buf;
+
+		lexer(buf, len).tokenize(tokens);
+		nr_tokens = tokens.size();
+	}
+
+	// Byte offset of the given token (the end of the buffer if we've run
+	// out of tokens). Since the lexer dropped all whitespace and comments,
+	// this is also the end of whatever came before it.
+	unsigned int offset(unsigned int i) const
+	{
+		if (i < nr_tokens)
+			return tokens[i].pos;
+
+		return len;
 	}
 
-	void skip_whitespace(unsigned int &pos);
-	void skip_comments(unsigned int &pos);
-	void skip_whitespace_and_comments(unsigned int &pos);
+	// Operators need something after them, so we never match one which
+	// ends at the very end of the buffer.
+	bool match_operator(unsigned int i, token_type type) const
+	{
+		return i < nr_tokens && tokens[i].type == type && tokens[i].end < len;
+	}
 
-	int parse_literal_integer(unsigned int &pos);
-	int parse_literal_string(unsigned int &pos);
-	int parse_symbol_name(unsigned int &pos);
-	int parse_atom(unsigned int &pos);
+	bool can_start_expr(unsigned int i) const;
 
-	int parse_outfix(ast_node_type type, const char *left, const char *right, unsigned int &pos);
+	int64_t decode_literal_integer(unsigned int pos, unsigned int end);
+	int parse_literal_integer(unsigned int &i);
+	int parse_literal_string(unsigned int &i);
+	int parse_symbol_name(unsigned int &i);
+	int parse_atom(unsigned int &i);
 
-	int parse_unop_prefix_as_call(precedence prec, const char *op, const char *symbol_name, unsigned int &pos);
+	int new_call(symbol_id symbol, unsigned int pos, unsigned int end, int args);
+	int new_binop(const binop *op, unsigned int op_index, int lhs, int rhs, unsigned int end);
 
-	int parse_binop(ast_node_type type, precedence prec, associativity assoc, bool allow_trailing, const char *op, int lhs, unsigned int &pos, unsigned int min_precedence);
-	int parse_binop_as_call(precedence prec, associativity assoc, bool allow_trailing, const char *op, const char *symbol_name,
-		int lhs, unsigned int &pos, unsigned int min_precedence);
+	void push_expr(unsigned int min_precedence);
+	void push_outfix(ast_node_type type, token_type right, unsigned int &i);
+	void push_prefix(symbol_id symbol, unsigned int &i);
+	bool push_operator(unsigned int &i);
 
-	int parse_expr(unsigned int &pos, unsigned int min_precedence = 0);
+	std::vector<parser_frame> stack;
 
-	int parse_doc(unsigned int &pos);
+	int parse_expr(unsigned int &i, unsigned int min_precedence = 0);
+
+	int parse_doc(unsigned int &i);
 };
 
-void parser::skip_whitespace(unsigned int &pos)
+// The parser never backtracks: before committing to an operand we check
+// whether the next token(s) can start an expression at all. This is
+// exactly the condition under which parse_expr() would fail, so we never
+// have to throw away any nodes that were already created.
+bool parser::can_start_expr(unsigned int i) const
 {
-	unsigned int i = pos;
-
-	while (i < len && isspace(buf[i]))
+	// Any number of prefix operators
+	while (match_operator(i, TOKEN_AT))
 		++i;
 
-	pos = i;
-}
+	if (i == nr_tokens)
+		return false;
 
-void parser::skip_comments(unsigned int &pos)
-{
-	unsigned int i = pos;
+	switch (tokens[i].type) {
+	case TOKEN_LEFT_PAREN:
+	case TOKEN_LEFT_SQUARE_BRACKET:
+	case TOKEN_LEFT_CURLY_BRACKET:
+		return match_operator(i, tokens[i].type);
 
-	if (i < len && buf[i] == '#') {
-		++i;
+	case TOKEN_LITERAL_INTEGER:
+	case TOKEN_LITERAL_STRING:
+	case TOKEN_UNTERMINATED_STRING:
+	case TOKEN_SYMBOL_NAME:
+	case TOKEN_SUBTRACT:
+		return true;
 
-		while (i < len && buf[i] != '\n')
-			++i;
-		if (i < len && buf[i] == '\n')
-			++i;
+	default:
+		break;
 	}
 
-	pos = i;
+	return false;
 }
 
-void parser::skip_whitespace_and_comments(unsigned int &pos)
+// Literals are an optional minus sign, decimal digits and an optional
+// base suffix (b, h, o or d); the lexer doesn't accept hex digits yet.
+int64_t parser::decode_literal_integer(unsigned int pos, unsigned int end)
 {
-	unsigned int i = pos;
-
-	while (true) {
-		skip_whitespace(i);
-		skip_comments(i);
+	bool negative = false;
+	if (pos < end && buf[pos] == '-') {
+		negative = true;
+		++pos;
+	}
 
-		if (i == len)
+	unsigned int base = 10;
+	if (pos < end) {
+		switch (buf[end - 1]) {
+		case 'b':
+			base = 2;
+			--end;
 			break;
-
-		// If we didn't skip anything, we should stop
-		if (i == pos)
+		case 'h':
+			base = 16;
+			--end;
 			break;
+		case 'o':
+			base = 8;
+			--end;
+			break;
+		case 'd':
+			base = 10;
+			--end;
+			break;
+		}
+	}
 
-		pos = i;
+	if (pos == end)
+		return ast_tree::INVALID_INTEGER;
+
+	uint64_t value = 0;
+	bool overflow = false;
+	for (unsigned int j = pos; j < end; ++j) {
+		unsigned int digit = buf[j] - '0';
+		if (digit >= base)
+			return ast_tree::INVALID_INTEGER;
+
+		overflow |= __builtin_mul_overflow(value, base, &value);
+		overflow |= __builtin_add_overflow(value, digit, &value);
 	}
 
-	pos = i;
-}
+	if (!overflow && value <= INT64_MAX / 2)
+		return tree.new_integer(negative ? -(int64_t) value : (int64_t) value);
 
-int parser::parse_literal_integer(unsigned int &pos)
-{
-	unsigned int i = pos;
+	mpz_class big;
+	big.set_str(std::string(&buf[pos], end - pos), base);
+	if (negative)
+		big = -big;
 
-	// TODO: this rejects hex digits, but if we use isxdigit() it
-	// will consume non-numbers
+	return tree.new_integer(big);
+}
 
-	if (i < len && (isdigit(buf[i]) || buf[i] == '-'))
-		++i;
-	while (i < len && isdigit(buf[i]))
-		++i;
-	if (i == pos)
+int parser::parse_literal_integer(unsigned int &i)
+{
+	if (i == nr_tokens)
 		return -1;
 
-	std::string str(buf + pos, i - pos);
-
-	if (i < len) {
-		if (buf[i] == 'b') {
-			++i;
-		} else if (buf[i] == 'h') {
-			++i;
-		} else if (buf[i] == 'o') {
-			++i;
-		} else if (buf[i] == 'd') {
-			++i;
+	const token &t = tokens[i];
+	unsigned int end;
+
+	if (t.type == TOKEN_LITERAL_INTEGER) {
+		end = t.end;
+		i += 1;
+	} else if (t.type == TOKEN_SUBTRACT) {
+		// A minus sign that is directly followed by digits is part
+		// of the literal
+		if (i + 1 < nr_tokens && tokens[i + 1].type == TOKEN_LITERAL_INTEGER && tokens[i + 1].pos == t.end) {
+			end = tokens[i + 1].end;
+			i += 2;
+		} else {
+			end = t.end;
+			i += 1;
 		}
+	} else {
+		return -1;
 	}
 
-	auto node_index = tree.new_node(AST_LITERAL_INTEGER, pos, i);
-
-	pos = i;
+	auto node_index = tree.new_node(AST_LITERAL_INTEGER, t.pos, end);
+	tree.children[node_index].integer = decode_literal_integer(t.pos, end);
 	return node_index;
 }
 
-int parser::parse_literal_string(unsigned int &pos)
+int parser::parse_literal_string(unsigned int &i)
 {
-	unsigned int i = pos;
+	if (i == nr_tokens)
+		return -1;
 
-	if (i == len || buf[i] != '\"')
+	const token &t = tokens[i];
+	if (t.type == TOKEN_UNTERMINATED_STRING)
+		throw syntax_error("unterminated string literal", t.pos, t.end);
+	if (t.type != TOKEN_LITERAL_STRING)
 		return -1;
-	++i;
 
-	std::vector<char> str;
+	unsigned int pos = t.pos + 1;
+	unsigned int len = t.end - t.pos - 2;
 
-	while (i < len && buf[i] != '\"') {
-		if (buf[i] == '\\') {
-			++i;
-			if (i == len)
-				throw syntax_error("unterminated string literal", pos, i);
-		}
+	auto node_index = tree.new_node(AST_LITERAL_STRING, t.pos, t.end);
+	auto &str = tree.children[node_index].string;
 
-		str.push_back(buf[i]);
+	if (!memchr(&buf[pos], '\\', len)) {
+		// Nothing to decode; just refer to the source
+		str.offset = pos;
+		str.length = len;
+	} else {
+		auto &arena = tree.string_arena;
+		str.offset = arena.size() | ast_tree::ARENA_BIT;
 
-		++i;
-	}
+		for (unsigned int j = pos; j < pos + len; ++j) {
+			if (buf[j] == '\\')
+				++j;
 
-	if (i == len || buf[i] != '\"')
-		throw syntax_error("unterminated string literal", pos, i);
-	++i;
+			arena.push_back(buf[j]);
+		}
 
-	auto node_index = tree.new_node(AST_LITERAL_STRING, pos, i);
-	auto node = tree.get(node_index);
-	node->string_index = tree.new_string(std::string(&str[0], str.size()));
+		str.length = arena.size() - (str.offset & ~ast_tree::ARENA_BIT);
+	}
 
-	pos = i;
+	i += 1;
 	return node_index;
 }
 
-int parser::parse_symbol_name(unsigned int &pos)
+int parser::parse_symbol_name(unsigned int &i)
 {
-	unsigned int i = pos;
-
-	if (i < len && (isalpha(buf[i]) || buf[i] == '_'))
-		++i;
-	while (i < len && (isalnum(buf[i]) || buf[i] == '_'))
-		++i;
-	if (i == pos)
+	if (i == nr_tokens || tokens[i].type != TOKEN_SYMBOL_NAME)
 		return -1;
 
-	auto node_index = tree.new_node(AST_SYMBOL_NAME, pos, i);
+	const token &t = tokens[i];
+	auto node_index = tree.new_node(AST_SYMBOL_NAME, t.pos, t.end);
+	tree.children[node_index].symbol = symbols.intern(&buf[t.pos], t.end - t.pos);
 
-	pos = i;
+	i += 1;
 	return node_index;
 }
 
-int parser::parse_atom(unsigned int &pos)
+int parser::parse_atom(unsigned int &i)
 {
 	int ptr = -1;
 
 	if (ptr == -1)
-		ptr = parse_literal_integer(pos);
+		ptr = parse_literal_integer(i);
 	if (ptr == -1)
-		ptr = parse_literal_string(pos);
+		ptr = parse_literal_string(i);
 	if (ptr == -1)
-		ptr = parse_symbol_name(pos);
-
-	if (ptr != -1)
-		skip_whitespace_and_comments(pos);
+		ptr = parse_symbol_name(i);
 
 	return ptr;
 }
 
-int parser::parse_outfix(ast_node_type type, const char *left, const char *right, unsigned int &pos)
+// Unary and binary operators that are parsed as calls to a built-in macro
+// turn into a juxtaposition of a symbol name and the operand(s).
+int parser::new_call(symbol_id symbol, unsigned int pos, unsigned int end, int args)
 {
-	unsigned int left_size = strlen(left);
-	unsigned int right_size = strlen(right);
-
-	unsigned int i = pos;
-
-	if (i + left_size >= len || strncmp(buf + i, left, left_size))
-		return -1;
-	i += left_size;
-
-	skip_whitespace_and_comments(i);
-
-	int operand = parse_expr(i);
-	// operand can be -1 when parsing e.g. "()"
-
-	skip_whitespace_and_comments(i);
+	auto symbol_name_node_index = tree.new_node(AST_SYMBOL_NAME, pos, end);
+	tree.children[symbol_name_node_index].symbol = symbol;
 
-	if (i + right_size > len || strncmp(buf + i, right, right_size))
-		throw syntax_error("expected terminator", i, i + right_size);
-	i += right_size;
+	auto node_index = tree.new_node(AST_JUXTAPOSE, pos, end);
+	tree.children[node_index].binop = { symbol_name_node_index, args };
 
-	auto node_index = tree.new_node(type, pos, i);
-	auto node = tree.get(node_index);
-	node->unop = operand;
-
-	skip_whitespace_and_comments(i);
-
-	pos = i;
 	return node_index;
 }
 
-int parser::parse_unop_prefix_as_call(precedence prec, const char *op, const char *symbol_name, unsigned int &pos)
+// Helper for parsing a binary operator, possibly as a call to a built-in
+// macro. This is kind of a transformation of the "true" AST which puts a
+// bit more of the language into the parser (and maybe makes it a bit less
+// elegant). We also have to create 2 more node objects than we would have
+// otherwise. But putting it here simplifies anything that needs to
+// traverse the AST later, since it can handle these operators in a uniform
+// way (as opposed to handling separate AST types for each built-in
+// operator).
+int parser::new_binop(const binop *op, unsigned int op_index, int lhs, int rhs, unsigned int end)
 {
-	unsigned int op_size = strlen(op);
-
-	unsigned int i = pos;
-
-	if (i + op_size >= len || strncmp(buf + i, op, op_size))
-		return -1;
-	i += op_size;
-
-	skip_whitespace_and_comments(i);
-
-	auto operand = parse_expr(i, prec);
-	if (operand == -1)
-		return -1;
-
-	auto symbol_name_node_index = tree.new_node(AST_SYMBOL_NAME, pos, i);
-	auto symbol_name_node = tree.get(symbol_name_node_index);
-	symbol_name_node->symbol_name = symbol_name;
+	assert(lhs != -1);
+	assert(rhs != -1);
 
-	auto node_index = tree.new_node(AST_JUXTAPOSE, pos, i);
-	auto node = tree.get(node_index);
-	node->binop.lhs = symbol_name_node_index;
-	node->binop.rhs = operand;
+	auto node_index = tree.new_node(op->symbol ? AST_JUXTAPOSE : op->type, tree.spans[lhs].pos, end);
+	tree.children[node_index].binop = { lhs, rhs };
 
-	skip_whitespace_and_comments(i);
+	if (op->symbol)
+		return new_call(op->symbol, offset(op_index), end, node_index);
 
-	pos = i;
 	return node_index;
 }
 
-// NOTE: We expect the caller to have parsed the left hand side already
-int parser::parse_binop(ast_node_type type, precedence prec, associativity assoc, bool allow_trailing, const char *op, int lhs, unsigned int &pos, unsigned int min_precedence)
+void parser::push_expr(unsigned int min_precedence)
 {
-	assert(lhs != -1);
+	parser_frame frame;
+	frame.kind = parser_frame::FRAME_EXPR;
+	frame.op_index = 0;
+	frame.expr.min_precedence = min_precedence;
+	frame.expr.lhs = -1;
+	frame.expr.op = nullptr;
+	stack.push_back(frame);
+}
 
-	unsigned int op_size = strlen(op);
+void parser::push_outfix(ast_node_type type, token_type right, unsigned int &i)
+{
+	parser_frame frame;
+	frame.kind = parser_frame::FRAME_OUTFIX;
+	frame.op_index = i++;
+	frame.outfix.type = type;
+	frame.outfix.right = right;
+	stack.push_back(frame);
+}
 
-	if (prec < min_precedence)
-		return -1;
+void parser::push_prefix(symbol_id symbol, unsigned int &i)
+{
+	parser_frame frame;
+	frame.kind = parser_frame::FRAME_PREFIX;
+	frame.op_index = i++;
+	frame.symbol = symbol;
+	stack.push_back(frame);
+}
 
-	unsigned int i = pos;
+// Look for a binary operator following the expression on top of the stack
+// and push a new expression for its right hand side. Returns false if the
+// expression ends here.
+bool parser::push_operator(unsigned int &i)
+{
+	unsigned int j = i;
+	unsigned int min_precedence = stack.back().expr.min_precedence;
 
-	if (i + op_size >= len || strncmp(buf + i, op, op_size))
-		return -1;
-	i += op_size;
+	while (true) {
+		// The token tells us directly which operator (if any) we
+		// are looking at
+		const binop *op = nullptr;
+		if (j < nr_tokens) {
+			op = &binops[tokens[j].type];
+			assert(op->token == tokens[j].type);
+
+			if (op->type == AST_UNKNOWN || op->prec < min_precedence || !match_operator(j, op->token))
+				op = nullptr;
+		}
 
-	skip_whitespace_and_comments(i);
+		if (op && can_start_expr(j + 1)) {
+			stack.back().op_index = j++;
+		} else if (op && op->allow_trailing) {
+			// Trailing comma or semicolon; just skip it
+			++j;
+			continue;
+		} else if (PREC_JUXTAPOSE >= min_precedence && can_start_expr(j)) {
+			// Juxtaposition doesn't have an operator token, so we
+			// try it if there was no other operator (or it didn't
+			// have a right hand side).
+			op = &juxtapose_binop;
+			stack.back().op_index = j;
+		} else {
+			i = j;
+			return false;
+		}
 
-	int rhs = parse_expr(i, prec + assoc);
-	if (rhs == -1) {
-		if (!allow_trailing)
-			return -1;
+		stack.back().expr.op = op;
+		push_expr(op->prec + op->assoc);
 
-		pos = i;
-		return lhs;
+		i = j;
+		return true;
 	}
-
-	auto node_index = tree.new_node(type, tree.get(lhs)->pos, i);
-	auto node = tree.get(node_index);
-	node->binop.lhs = lhs;
-	node->binop.rhs = rhs;
-
-	skip_whitespace_and_comments(i);
-
-	pos = i;
-	return node_index;
 }
 
-// Helper wrapper for parsing a binary operator as a call to a built-in macro.
-// This is kind of a transformation of the "true" AST which puts a bit more of
-// the language into the parser (and maybe makes it a bit less elegant). We
-// also have to create 2 more node objects than we would have otherwise. But
-// putting it here simplifies anything that needs to traverse the AST later,
-// since it can handle these operators in a uniform way (as opposed to
-// handling separate AST types for each built-in operator).
-int parser::parse_binop_as_call(precedence prec, associativity assoc, bool allow_trailing, const char *op, const char *symbol_name,
-	int lhs, unsigned int &pos, unsigned int min_precedence)
+int parser::parse_expr(unsigned int &i, unsigned int min_precedence)
 {
-	unsigned int i = pos;
+	unsigned int j = i;
 
-	auto args = parse_binop(AST_JUXTAPOSE, prec, assoc, allow_trailing, op, lhs, i, min_precedence);
-	if (args == -1)
+	if (!can_start_expr(j))
 		return -1;
 
-	auto symbol_name_node_index = tree.new_node(AST_SYMBOL_NAME, pos, i);
-	auto symbol_name_node = tree.get(symbol_name_node_index);
-	symbol_name_node->symbol_name = symbol_name;
+	auto base = stack.size();
+	push_expr(min_precedence);
 
-	auto node_index = tree.new_node(AST_JUXTAPOSE, pos, i);
-	auto node = tree.get(node_index);
-	node->binop.lhs = symbol_name_node_index;
-	node->binop.rhs = args;
-
-	skip_whitespace_and_comments(i);
-
-	pos = i;
-	return node_index;
-}
-
-int parser::parse_expr(unsigned int &pos, unsigned int min_precedence)
-{
-	unsigned int i = pos;
-
-	/* Outfix unary operators */
-	int lhs = -1;
-	if (lhs == -1)
-		lhs = parse_outfix(AST_BRACKETS, "(", ")", i);
-	if (lhs == -1)
-		lhs = parse_outfix(AST_SQUARE_BRACKETS, "[", "]", i);
-	if (lhs == -1)
-		lhs = parse_outfix(AST_CURLY_BRACKETS, "{", "}", i);
-
-	/* Unary prefix operators */
-	if (lhs == -1)
-		lhs = parse_unop_prefix_as_call(PREC_AT, "@", "_eval", i);
-
-	/* Infix binary operators (basically anything that starts with a literal) */
-	if (lhs == -1)
-		lhs = parse_atom(i);
-
-	if (lhs == -1)
-		return -1;
+	while (true) {
+		// The frame on top of the stack is an expression that needs
+		// an operand; we know from can_start_expr() that there is one.
+		int result;
+
+		switch (tokens[j].type) {
+		/* Outfix unary operators */
+		case TOKEN_LEFT_PAREN:
+			push_outfix(AST_BRACKETS, TOKEN_RIGHT_PAREN, j);
+			break;
+		case TOKEN_LEFT_SQUARE_BRACKET:
+			push_outfix(AST_SQUARE_BRACKETS, TOKEN_RIGHT_SQUARE_BRACKET, j);
+			break;
+		case TOKEN_LEFT_CURLY_BRACKET:
+			push_outfix(AST_CURLY_BRACKETS, TOKEN_RIGHT_CURLY_BRACKET, j);
+			break;
 
-	int result = -1;
+		/* Unary prefix operators */
+		case TOKEN_AT:
+			push_prefix(SYMBOL_EVAL, j);
+			push_expr(PREC_AT);
+			continue;
 
-	while (true) {
-		/* We want comma and semicolon lists to behave like they
-		 * typically do in lisp, scheme, etc. where you have the
-		 * head of the list as the first operand and then the rest
-		 * of it as the second operand; therefore they should right
-		 * associative. The same goes for juxtaposition. */
-
-		// This must appear before ":" since that's a prefix
-		if (result == -1)
-			result = parse_binop_as_call(PREC_DEFINE, ASSOC_LEFT, false, ":=", "_define", lhs, i, min_precedence);
-
-		if (result == -1)
-			result = parse_binop(AST_MEMBER, PREC_MEMBER, ASSOC_LEFT, false, ".", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_PAIR, ASSOC_LEFT, false, ":", "_declare", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_MULTIPLY_DIVIDE, ASSOC_LEFT, false, "*", "_multiply", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_MULTIPLY_DIVIDE, ASSOC_LEFT, false, "/", "_divide", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_ADD_SUBTRACT, ASSOC_LEFT, false, "+", "_add", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_ADD_SUBTRACT, ASSOC_LEFT, false, "-", "_subtract", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop(AST_COMMA, PREC_COMMA, ASSOC_RIGHT, true, ",", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_EQUALITY, ASSOC_LEFT, false, "==", "_equals", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_EQUALITY, ASSOC_LEFT, false, "!=", "_notequals", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_EQUALITY, ASSOC_LEFT, false, "<", "_less", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_EQUALITY, ASSOC_LEFT, false, "<=", "_less_equal", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_EQUALITY, ASSOC_LEFT, false, ">", "_greater", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_EQUALITY, ASSOC_LEFT, false, ">=", "_greater_equal", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop_as_call(PREC_ASSIGN, ASSOC_LEFT, false, "=", "_assign", lhs, i, min_precedence);
-		if (result == -1)
-			result = parse_binop(AST_SEMICOLON, PREC_SEMICOLON, ASSOC_RIGHT, true, ";", lhs, i, min_precedence);
-
-		// This must appear last since it's a prefix of any other
-		// operator.
-		if (result == -1)
-			result = parse_binop(AST_JUXTAPOSE, PREC_JUXTAPOSE, ASSOC_RIGHT, false, "", lhs, i, min_precedence);
-
-		if (result == -1) {
-			result = lhs;
+		/* Infix binary operators (basically anything that starts with a literal) */
+		default:
 			break;
 		}
 
-		lhs = result;
-		result = -1;
-	}
+		if (stack.back().kind == parser_frame::FRAME_OUTFIX) {
+			if (can_start_expr(j)) {
+				push_expr(0);
+				continue;
+			}
+
+			// operand can be -1 when parsing e.g. "()"
+			result = -1;
+		} else {
+			result = parse_atom(j);
+			assert(result != -1);
+		}
 
-	pos = i;
-	return result;
+		// Hand the result down the stack until we find an expression
+		// that wants another operand
+		while (true) {
+			parser_frame &frame = stack.back();
+
+			if (frame.kind == parser_frame::FRAME_OUTFIX) {
+				if (j == nr_tokens || tokens[j].type != frame.outfix.right)
+					throw syntax_error("expected terminator", offset(j), offset(j) + 1);
+				++j;
+
+				auto node_index = tree.new_node(frame.outfix.type, tokens[frame.op_index].pos, tokens[j - 1].end);
+				tree.children[node_index].unop = result;
+
+				result = node_index;
+				stack.pop_back();
+				continue;
+			}
+
+			if (frame.kind == parser_frame::FRAME_PREFIX) {
+				result = new_call(frame.symbol, offset(frame.op_index), offset(j), result);
+				stack.pop_back();
+				continue;
+			}
+
+			if (frame.expr.lhs == -1)
+				frame.expr.lhs = result;
+			else
+				frame.expr.lhs = new_binop(frame.expr.op, frame.op_index, frame.expr.lhs, result, offset(j));
+
+			if (push_operator(j))
+				break;
+
+			result = stack.back().expr.lhs;
+			stack.pop_back();
+
+			if (stack.size() == base) {
+				i = j;
+				return result;
+			}
+		}
+	}
 }
 
-int parser::parse_doc(unsigned int &pos)
+int parser::parse_doc(unsigned int &i)
 {
-	unsigned int i = pos;
-
-	skip_whitespace_and_comments(i);
+	unsigned int j = i;
 
-	auto result = parse_expr(i);
+	auto result = parse_expr(j);
 	if (result == -1)
-		throw syntax_error("expected expression", i, i + 1);
+		throw syntax_error("expected expression", offset(j), offset(j) + 1);
 
-	if (i != len)
-		throw syntax_error("expected end-of-file", i, len - 1);
+	if (j != nr_tokens)
+		throw syntax_error("expected end-of-file", offset(j), len - 1);
 
-	pos = i;
+	i = j;
 	return result;
 }
 
@@ -0,0 +1,198 @@
+//
+//  V compiler
+//  Copyright (C) 2017  Vegard Nossum <vegard.nossum@gmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef V_REF_PTR_HH
+#define V_REF_PTR_HH
+
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+// Intrusive, non-atomic reference counting for the things the compiler
+// passes around for every node it compiles (scopes, contexts, functions
+// and source files). Since we link with -pthread, every std::shared_ptr
+// copy is a locked read-modify-write.
+//
+// None of these are ever shared between threads once they have been
+// created; the parser threads (see parse_pool) only borrow the source
+// files that the main thread owns.
+struct refcounted {
+	unsigned int refcount;
+
+	refcounted():
+		refcount(0)
+	{
+	}
+
+	// A copy is a new object with its own references
+	refcounted(const refcounted &):
+		refcount(0)
+	{
+	}
+
+	refcounted &operator=(const refcounted &)
+	{
+		return *this;
+	}
+};
+
+// T must derive from refcounted. If anything derives from T, T needs a
+// virtual destructor, since this is what deletes the object.
+template<typename T>
+struct ref_ptr {
+	T *ptr;
+
+	ref_ptr():
+		ptr(nullptr)
+	{
+	}
+
+	ref_ptr(std::nullptr_t):
+		ptr(nullptr)
+	{
+	}
+
+	explicit ref_ptr(T *ptr):
+		ptr(ptr)
+	{
+		if (ptr)
+			++ptr->refcount;
+	}
+
+	ref_ptr(const ref_ptr &other):
+		ref_ptr(other.ptr)
+	{
+	}
+
+	ref_ptr(ref_ptr &&other):
+		ptr(other.ptr)
+	{
+		other.ptr = nullptr;
+	}
+
+	template<typename U, typename = typename std::enable_if<std::is_convertible<U *, T *>::value>::type>
+	ref_ptr(const ref_ptr<U> &other):
+		ref_ptr(other.ptr)
+	{
+	}
+
+	template<typename U, typename = typename std::enable_if<std::is_convertible<U *, T *>::value>::type>
+	ref_ptr(ref_ptr<U> &&other):
+		ptr(other.ptr)
+	{
+		other.ptr = nullptr;
+	}
+
+	~ref_ptr()
+	{
+		T *p = ptr;
+		if (p && !--p->refcount)
+			delete p;
+	}
+
+	ref_ptr &operator=(ref_ptr other)
+	{
+		std::swap(ptr, other.ptr);
+		return *this;
+	}
+
+	void reset()
+	{
+		ref_ptr().swap(*this);
+	}
+
+	void swap(ref_ptr &other)
+	{
+		std::swap(ptr, other.ptr);
+	}
+
+	T *get() const
+	{
+		return ptr;
+	}
+
+	T &operator*() const
+	{
+		return *ptr;
+	}
+
+	T *operator->() const
+	{
+		return ptr;
+	}
+
+	explicit operator bool() const
+	{
+		return ptr;
+	}
+};
+
+template<typename T, typename U>
+bool operator==(const ref_ptr<T> &a, const ref_ptr<U> &b)
+{
+	return a.get() == b.get();
+}
+
+template<typename T, typename U>
+bool operator!=(const ref_ptr<T> &a, const ref_ptr<U> &b)
+{
+	return a.get() != b.get();
+}
+
+template<typename T>
+bool operator==(const ref_ptr<T> &a, std::nullptr_t)
+{
+	return !a.get();
+}
+
+template<typename T>
+bool operator!=(const ref_ptr<T> &a, std::nullptr_t)
+{
+	return a.get();
+}
+
+template<typename T>
+bool operator<(const ref_ptr<T> &a, const ref_ptr<T> &b)
+{
+	return std::less<T *>()(a.get(), b.get());
+}
+
+template<typename T, typename... Args>
+ref_ptr<T> make_ref(Args&&... args)
+{
+	return ref_ptr<T>(new T(std::forward<Args>(args)...));
+}
+
+template<typename U, typename T>
+ref_ptr<U> dynamic_ref_cast(const ref_ptr<T> &x)
+{
+	return ref_ptr<U>(dynamic_cast<U *>(x.get()));
+}
+
+namespace std {
+	template<typename T>
+	struct hash<ref_ptr<T>> {
+		size_t operator()(const ref_ptr<T> &x) const
+		{
+			return hash<T *>()(x.get());
+		}
+	};
+}
+
+#endif
@@ -22,28 +22,51 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 
+#include "arena.hh"
 #include "ast.hh"
 #include "compile_error.hh"
 #include "macro.hh"
+#include "ref_ptr.hh"
 #include "value.hh"
 
 struct scope;
-typedef std::shared_ptr<scope> scope_ptr;
+typedef ref_ptr<scope> scope_ptr;
 
 // Evaluation context (used to detect when trying to evaluate a symbol which
 // was defined in the same context)
 struct context;
-typedef std::shared_ptr<context> context_ptr;
+typedef ref_ptr<context> context_ptr;
 
-struct context {
+struct context: refcounted {
 	context_ptr parent;
 
+	// Distance from the root (which has depth 0). Nested evals can make
+	// the chain hundreds deep, so when checking whether some context is
+	// one of our ancestors, we only walk up as far as its depth instead
+	// of all the way to the root.
+	unsigned int depth;
+
 	// No default argument for the parent, since that makes it easier
 	// to introduce bugs if you forget it
 	context(context_ptr parent):
-		parent(parent)
+		parent(parent),
+		depth(parent ? parent->depth + 1 : 0)
+	{
+	}
+
+	// Parent, grandparent, etc.; not ourselves
+	bool has_ancestor(const context *c) const
 	{
+		if (!c || c->depth >= depth)
+			return false;
+
+		const context *ancestor = parent.get();
+		for (unsigned int i = depth - 1; i > c->depth; --i)
+			ancestor = ancestor->parent.get();
+
+		return ancestor == c;
 	}
 
 	~context()
@@ -53,7 +76,7 @@ struct context {
 
 // Map symbol names to values.
 // TODO: keep track of _where_ a symbol was defined?
-struct scope {
+struct scope: refcounted {
 	struct entry {
 		function_ptr f;
 		source_file_ptr source;
@@ -61,44 +84,78 @@ struct scope {
 		value_ptr val;
 	};
 
+	// Symbol IDs are small, dense integers, so they make good hashes
+	// just as they are
+	struct symbol_hash {
+		size_t operator()(symbol_id symbol) const
+		{
+			return symbol;
+		}
+	};
+
 	scope_ptr parent;
-	std::map<std::string, entry> contents;
 
-	std::vector<value_ptr> values;
+	// Most scopes only ever hold a handful of definitions (function
+	// arguments, a block's locals, 'break' and 'continue' for a loop
+	// body), so the first few go in here and are searched linearly.
+	// The rest go in 'contents'. Entries never move once defined.
+	static const unsigned int nr_inline_entries = 4;
+	unsigned int nr_inline;
+	symbol_id inline_symbols[nr_inline_entries];
+	entry inline_entries[nr_inline_entries];
+
+	std::unordered_map<symbol_id, entry, symbol_hash> contents;
+
+	// Owned by a top-level scope and shared with all its children (which
+	// can't outlive it). Values (and the memory behind compile-time
+	// globals) may be used after the scope that made them is gone (e.g.
+	// when the metaprogram runs), so they belong to the whole
+	// compilation session instead.
+	std::unique_ptr<arena> own_storage;
+	arena *storage;
 
 	scope(scope_ptr parent = nullptr):
-		parent(parent)
+		parent(parent),
+		nr_inline(0)
 	{
+		if (parent) {
+			storage = parent->storage;
+		} else {
+			own_storage.reset(new arena());
+			storage = own_storage.get();
+		}
 	}
 
-	~scope()
+	value_ptr make_value()
 	{
-		for (auto it: values)
-			delete it;
+		return storage->make<value>();
 	}
 
-	value_ptr make_value()
+	value_ptr make_value(const context_ptr &context, value_storage_type storage_type, value_type_ptr type)
 	{
-		auto v = new value();
-		values.push_back(v);
-		return v;
+		return storage->make<value>(context, storage_type, type);
 	}
 
-	value_ptr make_value(context_ptr context, value_storage_type storage_type, value_type_ptr type)
+	value_ptr make_value(const context_ptr &context, value_type_ptr type, unsigned int object_id)
 	{
-		auto v = new value(context, storage_type, type);
-		values.push_back(v);
-		return v;
+		return storage->make<value>(context, type, object_id);
 	}
 
-	value_ptr make_value(context_ptr context, value_type_ptr type, unsigned int object_id)
+	// Host memory for a compile-time global of the given type
+	void *alloc_global(value_type_ptr type)
 	{
-		auto v = new value(context, type, object_id);
-		values.push_back(v);
-		return v;
+		return storage->alloc(type->size);
 	}
 
-	void define(function_ptr f, source_file_ptr source, ast_node_ptr node, const std::string name, value_ptr val)
+	// A copy of 'x' that lives as long as the session, for when we
+	// need to hand out a pointer to it (e.g. as a global's host_address)
+	template<typename t>
+	t *make(const t &x)
+	{
+		return storage->make<t>(x);
+	}
+
+	void define(const function_ptr &f, const source_file_ptr &source, ast_node_ptr node, symbol_id symbol, value_ptr val)
 	{
 		entry e = {
 			.f = f,
@@ -110,24 +167,65 @@ struct scope {
 		if (f) {
 			switch (val->storage_type) {
 			case VALUE_GLOBAL:
-				f->comment(format("define global var $", name));
+				f->comment("define global var", symbol);
 				break;
 			case VALUE_TARGET_GLOBAL:
-				f->comment(format("define target global var $", name));
+				f->comment("define target global var", symbol);
 				break;
 			case VALUE_LOCAL:
-				f->comment(format("define local var $", name));
+				f->comment("define local var", symbol);
 				break;
 			case VALUE_LOCAL_POINTER:
-				f->comment(format("define local pointer var $", name));
+				f->comment("define local pointer var", symbol);
 				break;
 			case VALUE_CONSTANT:
-				f->comment(format("define constant var $", name));
+				f->comment("define constant var", symbol);
 				break;
 			}
 		}
 
-		contents[name] = e;
+		if (entry *old = find(symbol))
+			*old = e;
+		else if (nr_inline < nr_inline_entries) {
+			inline_symbols[nr_inline] = symbol;
+			inline_entries[nr_inline] = e;
+			++nr_inline;
+		} else
+			contents[symbol] = e;
+	}
+
+	// Only looks in this scope, not the parents
+	entry *find(symbol_id symbol)
+	{
+		for (unsigned int i = 0; i < nr_inline; ++i) {
+			if (inline_symbols[i] == symbol)
+				return &inline_entries[i];
+		}
+
+		if (contents.empty())
+			return nullptr;
+
+		auto it = contents.find(symbol);
+		if (it == contents.end())
+			return nullptr;
+
+		return &it->second;
+	}
+
+	const entry *find(symbol_id symbol) const
+	{
+		return const_cast<scope *>(this)->find(symbol);
+	}
+
+	// Calls fn(symbol, entry) for everything defined in this scope
+	template<typename Fn>
+	void for_each(Fn fn) const
+	{
+		for (unsigned int i = 0; i < nr_inline; ++i)
+			fn(inline_symbols[i], inline_entries[i]);
+
+		for (const auto &it: contents)
+			fn(it.first, it.second);
 	}
 
 	// Helper for defining builtin types
@@ -135,9 +233,8 @@ struct scope {
 	void define_builtin_type(const std::string name, value_type_ptr type)
 	{
 		auto type_value = make_value(nullptr, VALUE_GLOBAL, builtin_type_type);
-		auto type_copy = new value_type_ptr(type);
-		type_value->global.host_address = (void *) type_copy;
-		define(nullptr, nullptr, nullptr, name, type_value);
+		type_value->global.host_address = (void *) make(type);
+		define(nullptr, nullptr, nullptr, symbols.intern(name), type_value);
 	}
 
 	// Helper for defining builtin macros
@@ -145,9 +242,8 @@ struct scope {
 	void define_builtin_macro(const std::string name, macro_ptr m)
 	{
 		auto macro_value = make_value(nullptr, VALUE_GLOBAL, builtin_type_macro);
-		auto macro_copy = new macro_ptr(m);
-		macro_value->global.host_address = (void *) macro_copy;
-		define(nullptr, nullptr, nullptr, name, macro_value);
+		macro_value->global.host_address = (void *) make(m);
+		define(nullptr, nullptr, nullptr, symbols.intern(name), macro_value);
 	}
 
 	void define_builtin_macro(const std::string name, value_ptr (*fn)(ast_node_ptr))
@@ -157,47 +253,77 @@ struct scope {
 
 	void define_builtin_namespace(const std::string name, value_ptr val)
 	{
-		define(nullptr, nullptr, nullptr, name, val);
+		define(nullptr, nullptr, nullptr, symbols.intern(name), val);
 	}
 
 	template<typename t>
 	void define_builtin_constant(const std::string name, value_type_ptr type, const t &constant_value)
 	{
 		auto type_value = make_value(nullptr, VALUE_GLOBAL, type);
-		auto copy = new t(constant_value);
-		type_value->global.host_address = (void *) copy;
-		define(nullptr, nullptr, nullptr, name, type_value);
+		type_value->global.host_address = (void *) make(constant_value);
+		define(nullptr, nullptr, nullptr, symbols.intern(name), type_value);
 	}
 
-	bool lookup(const std::string name, entry &result)
+	// Returns nullptr if the symbol is not defined in this scope or any
+	// of its parents. The entry stays valid for as long as this scope
+	// does (scopes keep their parents alive).
+	const entry *lookup(symbol_id symbol) const
 	{
-		auto it = contents.find(name);
-		if (it != contents.end()) {
-			result = it->second;
-			return true;
+		for (const scope *s = this; s; s = s->parent.get()) {
+			if (const entry *e = s->find(symbol))
+				return e;
 		}
 
-		// Recursively search parent scopes
-		if (parent)
-			return parent->lookup(name, result);
+		return nullptr;
+	}
+};
+
+// A scope that lives on the C++ stack, for the scopes that blocks, loops
+// and macros put around whatever they compile. Nothing may hold on to
+// one after it goes out of scope; we hold a reference of our own so the
+// last scope_ptr to it doesn't try to delete it.
+struct scope_frame: scope {
+	explicit scope_frame(const scope_ptr &parent):
+		scope(parent)
+	{
+		assert(parent);
+		++refcount;
+	}
+
+	scope_frame(const scope_frame &) = delete;
+	scope_frame &operator=(const scope_frame &) = delete;
+
+	~scope_frame()
+	{
+		assert(refcount == 1);
+	}
 
-		return false;
+	scope_ptr ptr()
+	{
+		return scope_ptr(this);
 	}
 };
 
-static bool is_parent_of(scope_ptr parent, scope_ptr child)
+// For macros that need to get back at the scope they were defined in
+// (or one of its children), like 'break' for a loop body. They can't hold
+// a reference, since the scope holds a reference to them and neither
+// would ever go away; but they're only ever used while compiling
+// something inside that scope, so it's always still there.
+typedef scope *borrowed_scope_ptr;
+
+static bool is_parent_of(const scope *parent, const scope *child)
 {
 	while (child) {
 		if (child == parent)
 			return true;
 
-		child = child->parent;
+		child = child->parent.get();
 	}
 
 	return false;
 }
 
-static bool can_use_value(context_ptr c, value_ptr val)
+static bool can_use_value(const context_ptr &c, value_ptr val)
 {
 #if 0
 	printf("use: ");
@@ -215,16 +341,17 @@ static bool can_use_value(context_ptr c, value_ptr val)
 #endif
 
 	assert(c);
-	while (true) {
-		c = c->parent;
-		if (!c)
-			break;
-
-		if (c == val->context)
-			return false;
-	}
+	return !c->has_ancestor(val->context.get());
+}
 
-	return true;
+// Macros and type constructors run while we compile, as if from a new
+// child of 'c' -- the same check as can_use_value(), except that they
+// also can't use values defined in 'c' itself.
+static bool can_use_value_at_compile_time(const context_ptr &c, value_ptr val)
+{
+	assert(c);
+	const context *val_context = val->context.get();
+	return val_context != c.get() && !c->has_ancestor(val_context);
 }
 
 #endif
@@ -34,14 +34,17 @@ extern "C" {
 #include <memory>
 
 #include "ast.hh"
+#include "ast_cache.hh"
 #include "format.hh"
+#include "globals.hh"
 #include "line_number_info.hh"
 #include "parser.hh"
+#include "ref_ptr.hh"
 
 struct source_file;
-typedef std::shared_ptr<source_file> source_file_ptr;
+typedef ref_ptr<source_file> source_file_ptr;
 
-struct source_file {
+struct source_file: refcounted {
 	const char *name;
 
 	const char *data;
@@ -77,8 +80,19 @@ struct source_file {
 
 	int parse()
 	{
-		unsigned int pos = 0;
-		return parser(data, data_size, tree).parse_doc(pos);
+		int root;
+		if (global_ast_cache_dir && load_ast_cache(global_ast_cache_dir, data, data_size, tree, root))
+			return root;
+
+		tree.reserve_for_source(data_size);
+
+		unsigned int i = 0;
+		root = parser(data, data_size, tree).parse_doc(i);
+
+		if (global_ast_cache_dir)
+			save_ast_cache(global_ast_cache_dir, data, data_size, tree, root);
+
+		return root;
 	}
 };
 
@@ -122,19 +136,34 @@ struct mmap_source_file: source_file {
 	}
 };
 
+// For source that doesn't come from a file (e.g. a line typed into the
+// REPL); we keep our own copy since the AST and string literals refer to it.
+struct string_source_file: source_file {
+	std::string buffer;
+
+	string_source_file(const char *name, std::string str):
+		buffer(str)
+	{
+		// initialize parent
+		this->name = name;
+		data = buffer.data();
+		data_size = buffer.size();
+	}
+};
+
 static std::string get_source_for(const source_file_ptr &source, const ast_node_ptr node)
 {
 	const line_number_info &line_numbers = source->line_numbers();
-	auto pos = line_numbers.lookup(node->pos);
-	auto end = line_numbers.lookup(node->end);
+	auto pos = line_numbers.lookup(node.pos());
+	auto end = line_numbers.lookup(node.end());
 
 	if (pos.line == end.line)
-		return std::string(source->data + node->pos, node->end - node->pos);
+		return std::string(source->data + node.pos(), node.end() - node.pos());
 
 	if (pos.line_length - 1 >= pos.column + 1)
-		return std::string(source->data + node->pos, pos.line_length - pos.column - 1) + "...";
+		return std::string(source->data + node.pos(), pos.line_length - pos.column - 1) + "...";
 
-	return std::string(source->data + node->pos, pos.line_length - pos.column);
+	return std::string(source->data + node.pos(), pos.line_length - pos.column);
 }
 
 static void print_message(const source_file_ptr &source, unsigned int pos_byte, unsigned int end_byte, std::string message)
@@ -144,16 +173,21 @@ static void print_message(const source_file_ptr &source, unsigned int pos_byte,
 	auto end = line_numbers.lookup(end_byte);
 
 	printf("%s:%u:%u: %s\n", source->name, pos.line, pos.column, message.c_str());
+
+	// Line the markers up by character rather than by byte
+	unsigned int pos_column = line_numbers.utf8_column(pos_byte);
 	if (pos.line == end.line) {
+		unsigned int end_column = line_numbers.utf8_column(end_byte);
 		printf("%.*s", pos.line_length, source->data + pos.line_start);
-		printf("%*s%s\n", pos.column, "", std::string(end.column - pos.column, '^').c_str());
+		printf("%*s%s\n", pos_column, "", std::string(end_column - pos_column, '^').c_str());
 	} else if (pos.line_length - 1 >= pos.column + 1) {
 		// TODO: print following lines as well?
+		unsigned int end_column = line_numbers.utf8_column(pos.line_start + pos.line_length - 1);
 		printf("%.*s", pos.line_length, source->data + pos.line_start);
-		printf("%*s%s\n", pos.column, "", std::string(pos.line_length - 1 - pos.column, '^').c_str());
+		printf("%*s%s\n", pos_column, "", std::string(end_column - pos_column, '^').c_str());
 	} else {
 		printf("%.*s\n", pos.line_length, source->data + pos.line_start);
-		printf("%*s%s\n", pos.column, "", std::string(pos.line_length - pos.column, '^').c_str());
+		printf("%*s%s\n", pos_column, "", std::string(pos.line_length - pos.column, '^').c_str());
 	}
 }
 
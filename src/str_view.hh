@@ -0,0 +1,39 @@
+//
+//  V compiler
+//  Copyright (C) 2017  Vegard Nossum <vegard.nossum@gmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef V_STR_VIEW_HH
+#define V_STR_VIEW_HH
+
+#include <cstddef>
+#include <string>
+
+// A string that we don't own. This is what string literals evaluate to
+// (it's also the in-memory representation of the 'str' type); the bytes
+// live either in the source file or in the AST's string arena, so
+// whoever hands one out must make sure those stay around.
+struct str_view {
+	const char *data;
+	size_t length;
+
+	std::string str() const
+	{
+		return std::string(data, length);
+	}
+};
+
+#endif
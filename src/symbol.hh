@@ -0,0 +1,216 @@
+//
+//  V compiler
+//  Copyright (C) 2017  Vegard Nossum <vegard.nossum@gmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef V_SYMBOL_HH
+#define V_SYMBOL_HH
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Symbol names are interned while parsing so that the rest of the
+// compiler (scopes, type members) can compare and look up 32-bit IDs
+// instead of strings.
+typedef uint32_t symbol_id;
+
+// Symbols that the compiler itself refers to. These are interned first
+// (in this order), so their IDs are known at compile time.
+enum builtin_symbol: symbol_id {
+	// Not a symbol
+	SYMBOL_NONE,
+
+	SYMBOL_DEFINE,
+	SYMBOL_DECLARE,
+	SYMBOL_MULTIPLY,
+	SYMBOL_DIVIDE,
+	SYMBOL_ADD,
+	SYMBOL_SUBTRACT,
+	SYMBOL_EQUALS,
+	SYMBOL_NOTEQUALS,
+	SYMBOL_LESS,
+	SYMBOL_LESS_EQUAL,
+	SYMBOL_GREATER,
+	SYMBOL_GREATER_EQUAL,
+	SYMBOL_ASSIGN,
+	SYMBOL_EVAL,
+	SYMBOL_CALL,
+	SYMBOL_ELSE,
+
+	NR_BUILTIN_SYMBOLS,
+};
+
+static const char *builtin_symbol_names[] = {
+	"",
+
+	"_define",
+	"_declare",
+	"_multiply",
+	"_divide",
+	"_add",
+	"_subtract",
+	"_equals",
+	"_notequals",
+	"_less",
+	"_less_equal",
+	"_greater",
+	"_greater_equal",
+	"_assign",
+	"_eval",
+	"_call",
+	"else",
+};
+
+static_assert(sizeof(builtin_symbol_names) / sizeof(*builtin_symbol_names) == NR_BUILTIN_SYMBOLS,
+	"every builtin symbol needs a name");
+
+// Open addressing (linear probing) hash table. Probing only needs a
+// pointer and a length, so interning a name straight out of the source
+// buffer doesn't allocate unless the name is new.
+//
+// Files may be parsed on several threads at once (see -j), in which case
+// everything goes through the lock. The names live in a deque so that
+// references returned by name() stay valid while other threads add new
+// names.
+struct symbol_table {
+	struct slot {
+		uint32_t hash;
+		// 0 means the slot is empty (SYMBOL_NONE is never stored)
+		symbol_id id;
+	};
+
+	// Set (once, before starting any other threads) by parse_pool;
+	// we don't want to pay for the lock when there's just one thread
+	bool concurrent;
+	mutable std::mutex mutex;
+
+	std::vector<slot> slots;
+	std::deque<std::string> names;
+
+	symbol_table():
+		concurrent(false),
+		slots(1024)
+	{
+		for (const char *name: builtin_symbol_names) {
+			if (names.empty())
+				names.push_back(name);
+			else
+				intern(name);
+		}
+	}
+
+	std::unique_lock<std::mutex> lock() const
+	{
+		if (!concurrent)
+			return std::unique_lock<std::mutex>();
+
+		return std::unique_lock<std::mutex>(mutex);
+	}
+
+	static uint32_t hash(const char *str, size_t len)
+	{
+		// FNV-1a
+		uint32_t result = 2166136261u;
+		for (size_t i = 0; i < len; ++i) {
+			result ^= (unsigned char) str[i];
+			result *= 16777619u;
+		}
+
+		return result;
+	}
+
+	void grow()
+	{
+		std::vector<slot> new_slots(2 * slots.size());
+		size_t mask = new_slots.size() - 1;
+
+		for (const slot &s: slots) {
+			if (!s.id)
+				continue;
+
+			size_t i = s.hash & mask;
+			while (new_slots[i].id)
+				i = (i + 1) & mask;
+
+			new_slots[i] = s;
+		}
+
+		slots.swap(new_slots);
+	}
+
+	symbol_id intern(const char *str, size_t len)
+	{
+		uint32_t h = hash(str, len);
+
+		auto guard = lock();
+		size_t mask = slots.size() - 1;
+
+		size_t i = h & mask;
+		while (slots[i].id) {
+			const slot &s = slots[i];
+			if (s.hash == h) {
+				const std::string &name = names[s.id];
+				if (name.size() == len && !memcmp(name.data(), str, len))
+					return s.id;
+			}
+
+			i = (i + 1) & mask;
+		}
+
+		symbol_id result = names.size();
+		names.push_back(std::string(str, len));
+		slots[i] = slot { h, result };
+
+		// Keep the load factor below 1/2
+		if (2 * names.size() > slots.size())
+			grow();
+
+		return result;
+	}
+
+	symbol_id intern(const char *str)
+	{
+		return intern(str, strlen(str));
+	}
+
+	symbol_id intern(const std::string &str)
+	{
+		return intern(str.data(), str.size());
+	}
+
+	const std::string &name(symbol_id id) const
+	{
+		auto guard = lock();
+		assert(id < names.size());
+		return names[id];
+	}
+
+	// Number of symbols (including SYMBOL_NONE) interned so far
+	size_t size() const
+	{
+		auto guard = lock();
+		return names.size();
+	}
+};
+
+static symbol_table symbols;
+
+#endif
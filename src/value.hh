@@ -19,7 +19,16 @@
 #ifndef V_VALUE_HH
 #define V_VALUE_HH
 
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "ast.hh"
 #include "object.hh"
+#include "ref_ptr.hh"
+#include "symbol.hh"
 
 enum value_storage_type {
 	// host global (direct pointer)
@@ -40,28 +49,36 @@ struct value;
 typedef value *value_ptr;
 
 struct context;
-typedef std::shared_ptr<context> context_ptr;
+typedef ref_ptr<context> context_ptr;
 
 struct function;
-typedef std::shared_ptr<function> function_ptr;
+typedef ref_ptr<function> function_ptr;
 
 struct scope;
-typedef std::shared_ptr<scope> scope_ptr;
-
-struct ast_node;
-typedef ast_node *ast_node_ptr;
+typedef ref_ptr<scope> scope_ptr;
 
 struct compile_state;
 typedef std::shared_ptr<compile_state> compile_state_ptr;
 
 typedef value_ptr (*operator_fn_type)(context_ptr, function_ptr, scope_ptr, value_ptr, ast_node_ptr);
 
+// See member::val_macro_fn()
+typedef value_ptr (*val_macro_fn_type)(value_ptr, ast_node_ptr);
+
 struct member {
 	virtual ~member()
 	{
 	}
 
 	virtual value_ptr invoke(value_ptr lhs, ast_node_ptr rhs_node) = 0;
+
+	// Non-null if invoke() just returns a macro which calls this with
+	// 'lhs' and the node it's invoked on (see macrofy_callback_member).
+	// Operators call it directly instead of creating the macro.
+	virtual val_macro_fn_type val_macro_fn()
+	{
+		return nullptr;
+	}
 };
 
 struct callback_member: member {
@@ -80,6 +97,71 @@ struct callback_member: member {
 
 typedef std::shared_ptr<member> member_ptr;
 
+// A type's members, by name. Operators (and _call) have builtin symbol
+// IDs, so each of those gets a fixed slot and finding one is a single
+// load. Everything else (struct fields, namespace contents) is kept
+// sorted by ID.
+struct member_table {
+	member_ptr builtin[NR_BUILTIN_SYMBOLS];
+	std::vector<std::pair<symbol_id, member_ptr>> others;
+
+	member_table()
+	{
+	}
+
+	member_table(std::initializer_list<std::pair<symbol_id, member_ptr>> members)
+	{
+		for (const auto &it: members)
+			(*this)[it.first] = it.second;
+	}
+
+	std::vector<std::pair<symbol_id, member_ptr>>::iterator lower_bound(symbol_id symbol)
+	{
+		return std::lower_bound(others.begin(), others.end(), symbol,
+			[](const std::pair<symbol_id, member_ptr> &x, symbol_id symbol) {
+				return x.first < symbol;
+			});
+	}
+
+	// Returns nullptr if there is no such member
+	member *find(symbol_id symbol) const
+	{
+		if (symbol < NR_BUILTIN_SYMBOLS)
+			return builtin[symbol].get();
+
+		auto it = const_cast<member_table *>(this)->lower_bound(symbol);
+		if (it == others.end() || it->first != symbol)
+			return nullptr;
+
+		return it->second.get();
+	}
+
+	member_ptr &operator[](symbol_id symbol)
+	{
+		if (symbol < NR_BUILTIN_SYMBOLS)
+			return builtin[symbol];
+
+		auto it = lower_bound(symbol);
+		if (it == others.end() || it->first != symbol)
+			it = others.insert(it, std::make_pair(symbol, member_ptr()));
+
+		return it->second;
+	}
+
+	// Calls fn(symbol, member) for each member, in order of ID
+	template<typename Fn>
+	void for_each(Fn fn) const
+	{
+		for (symbol_id symbol = 0; symbol < NR_BUILTIN_SYMBOLS; ++symbol) {
+			if (builtin[symbol])
+				fn(symbol, builtin[symbol]);
+		}
+
+		for (const auto &it: others)
+			fn(it.first, it.second);
+	}
+};
+
 struct value_type {
 	// TODO
 	unsigned int alignment;
@@ -93,7 +175,7 @@ struct value_type {
 	value_type_ptr return_type;
 
 	// Members
-	std::map<std::string, member_ptr> members;
+	member_table members;
 };
 
 struct value {
@@ -127,14 +209,14 @@ struct value {
 	{
 	}
 
-	value(context_ptr context, value_storage_type storage_type, value_type_ptr type):
+	value(const context_ptr &context, value_storage_type storage_type, value_type_ptr type):
 		context(context),
 		storage_type(storage_type),
 		type(type)
 	{
 	}
 
-	value(context_ptr context, value_type_ptr type, unsigned int object_id):
+	value(const context_ptr &context, value_type_ptr type, unsigned int object_id):
 		context(context),
 		storage_type(VALUE_TARGET_GLOBAL),
 		type(type)
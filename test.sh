@@ -6,10 +6,36 @@ set -u
 #v="valgrind --quiet ./v"
 v=./v
 
+ast_cache=$(mktemp -d)
+trap 'rm -rf "$ast_cache"' EXIT
+
 for file in tests/parser/*.v
 do
 	echo $file
 	diff -U100 ${file%.v}.out <($v --dump-ast --no-compile $file) || true
+	# The parser should never leave unreachable nodes behind
+	$v --dump-ast-stats --no-compile $file | awk '$2 != $5'
+	# Once to fill the cache, once to read it back
+	$v --ast-cache=$ast_cache --no-compile $file
+	diff -U100 ${file%.v}.out <($v --ast-cache=$ast_cache --dump-ast --no-compile $file) || true
+done
+
+# A corrupt cache file should just be a cache miss. Big integers are
+# the last thing in the file; turn the last digit of one into garbage.
+echo "corrupt ast cache"
+file=tests/parser/literal_integer_bool.v
+corrupt_cache=$ast_cache/corrupt
+$v --ast-cache=$corrupt_cache --no-compile $file
+for cache in $corrupt_cache/*.vast
+do
+	printf z | dd of=$cache bs=1 seek=$(($(stat -c %s $cache) - 2)) conv=notrunc 2>/dev/null
+done
+diff -U100 ${file%.v}.out <($v --ast-cache=$corrupt_cache --dump-ast --no-compile $file) || true
+
+for file in tests/jsonl/*.v
+do
+	echo $file
+	diff -U100 ${file%.v}.out <($v --dump-ast-jsonl --no-compile $file) || true
 done
 
 for file in tests/builtin/*.v
@@ -31,3 +57,20 @@ do
 	$v $file >/dev/null
 	diff -U100 ${file%.v}.out <(${file}.exe; echo $?) || true
 done
+
+# Compiling the same files over and over again in one process shouldn't
+# make us use more memory; everything belonging to one file's top-level
+# scope should go away with it.
+peak_rss()
+{
+	$v -Xreport-rss "$@" 2>&1 >/dev/null | awk '/^peak rss:/ { print $3 }'
+}
+
+echo "memory use"
+rss_files="tests/builtin/macro.v tests/builtin/struct.v tests/builtin/fun-return.v tests/builtin/while-break.v"
+rss_1000=$(peak_rss $(yes $rss_files | head -1000))
+rss_10000=$(peak_rss $(yes $rss_files | head -10000))
+# Allow for a bit of growth; all the files are opened up front
+if [ $((rss_10000 - rss_1000)) -gt 4096 ]; then
+	echo "peak rss grew from $rss_1000 kB to $rss_10000 kB"
+fi
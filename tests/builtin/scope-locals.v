@@ -0,0 +1,20 @@
+a := u64 1;
+f := u64 6;
+
+{
+	# More definitions than a scope keeps inline
+	a := u64 10;
+	b := u64 20;
+	c := u64 30;
+	d := u64 40;
+	e := u64 50;
+	f := u64 60;
+	print (a + b + c + d + e + f);
+
+	# Redefining something replaces it, whether it's kept inline or not
+	a := u64 100;
+	f := u64 600;
+	print (a + f);
+};
+
+print (a + f);
@@ -0,0 +1,4 @@
+x := str "Hello \"world\"!";
+y := str "back\\slash";
+print x;
+print y;
@@ -0,0 +1 @@
+print u64 12b;
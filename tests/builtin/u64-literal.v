@@ -0,0 +1,6 @@
+print u64 101b;
+print u64 17o;
+print u64 20h;
+print u64 10d;
+print u64 4611686018427387904;
+print u64 18446744073709551615;
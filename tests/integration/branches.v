@@ -0,0 +1,23 @@
+@count_type := fun u64(u64, u64, u64);
+@count : count_type;
+@count = count_type(n, m, acc) {
+    while (n < m) {
+        if (n == u64 3)
+            (acc = acc + u64 1);
+        if (n != m)
+            (acc = acc + u64 10);
+        if (n < u64 5)
+            (acc = acc + u64 100)
+        else
+            (acc = acc + u64 1000);
+        if (m < n)
+            (acc = acc + u64 10000);
+        n = n + u64 1;
+    };
+    while (n != u64 0)
+        (n = n - u64 1);
+    return acc + n;
+};
+
+print count(u64 0, u64 10, u64 0);
+print count(u64 12, u64 10, u64 0);
@@ -0,0 +1,9 @@
+@sum_type := fun u64(u64);
+@sum : sum_type;
+@sum = sum_type(n) {
+    if (n == u64 0)
+        (return n);
+    return (n + sum(n - u64 1));
+};
+
+print sum(u64 100000);
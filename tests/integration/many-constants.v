@@ -0,0 +1,302 @@
+x := u64 0;
+x = x + u64 1;
+x = x + u64 2;
+x = x + u64 3;
+x = x + u64 4;
+x = x + u64 5;
+x = x + u64 6;
+x = x + u64 7;
+x = x + u64 8;
+x = x + u64 9;
+x = x + u64 10;
+x = x + u64 11;
+x = x + u64 12;
+x = x + u64 13;
+x = x + u64 14;
+x = x + u64 15;
+x = x + u64 16;
+x = x + u64 17;
+x = x + u64 18;
+x = x + u64 19;
+x = x + u64 20;
+x = x + u64 21;
+x = x + u64 22;
+x = x + u64 23;
+x = x + u64 24;
+x = x + u64 25;
+x = x + u64 26;
+x = x + u64 27;
+x = x + u64 28;
+x = x + u64 29;
+x = x + u64 30;
+x = x + u64 31;
+x = x + u64 32;
+x = x + u64 33;
+x = x + u64 34;
+x = x + u64 35;
+x = x + u64 36;
+x = x + u64 37;
+x = x + u64 38;
+x = x + u64 39;
+x = x + u64 40;
+x = x + u64 41;
+x = x + u64 42;
+x = x + u64 43;
+x = x + u64 44;
+x = x + u64 45;
+x = x + u64 46;
+x = x + u64 47;
+x = x + u64 48;
+x = x + u64 49;
+x = x + u64 50;
+x = x + u64 51;
+x = x + u64 52;
+x = x + u64 53;
+x = x + u64 54;
+x = x + u64 55;
+x = x + u64 56;
+x = x + u64 57;
+x = x + u64 58;
+x = x + u64 59;
+x = x + u64 60;
+x = x + u64 61;
+x = x + u64 62;
+x = x + u64 63;
+x = x + u64 64;
+x = x + u64 65;
+x = x + u64 66;
+x = x + u64 67;
+x = x + u64 68;
+x = x + u64 69;
+x = x + u64 70;
+x = x + u64 71;
+x = x + u64 72;
+x = x + u64 73;
+x = x + u64 74;
+x = x + u64 75;
+x = x + u64 76;
+x = x + u64 77;
+x = x + u64 78;
+x = x + u64 79;
+x = x + u64 80;
+x = x + u64 81;
+x = x + u64 82;
+x = x + u64 83;
+x = x + u64 84;
+x = x + u64 85;
+x = x + u64 86;
+x = x + u64 87;
+x = x + u64 88;
+x = x + u64 89;
+x = x + u64 90;
+x = x + u64 91;
+x = x + u64 92;
+x = x + u64 93;
+x = x + u64 94;
+x = x + u64 95;
+x = x + u64 96;
+x = x + u64 97;
+x = x + u64 98;
+x = x + u64 99;
+x = x + u64 100;
+x = x + u64 101;
+x = x + u64 102;
+x = x + u64 103;
+x = x + u64 104;
+x = x + u64 105;
+x = x + u64 106;
+x = x + u64 107;
+x = x + u64 108;
+x = x + u64 109;
+x = x + u64 110;
+x = x + u64 111;
+x = x + u64 112;
+x = x + u64 113;
+x = x + u64 114;
+x = x + u64 115;
+x = x + u64 116;
+x = x + u64 117;
+x = x + u64 118;
+x = x + u64 119;
+x = x + u64 120;
+x = x + u64 121;
+x = x + u64 122;
+x = x + u64 123;
+x = x + u64 124;
+x = x + u64 125;
+x = x + u64 126;
+x = x + u64 127;
+x = x + u64 128;
+x = x + u64 129;
+x = x + u64 130;
+x = x + u64 131;
+x = x + u64 132;
+x = x + u64 133;
+x = x + u64 134;
+x = x + u64 135;
+x = x + u64 136;
+x = x + u64 137;
+x = x + u64 138;
+x = x + u64 139;
+x = x + u64 140;
+x = x + u64 141;
+x = x + u64 142;
+x = x + u64 143;
+x = x + u64 144;
+x = x + u64 145;
+x = x + u64 146;
+x = x + u64 147;
+x = x + u64 148;
+x = x + u64 149;
+x = x + u64 150;
+x = x + u64 151;
+x = x + u64 152;
+x = x + u64 153;
+x = x + u64 154;
+x = x + u64 155;
+x = x + u64 156;
+x = x + u64 157;
+x = x + u64 158;
+x = x + u64 159;
+x = x + u64 160;
+x = x + u64 161;
+x = x + u64 162;
+x = x + u64 163;
+x = x + u64 164;
+x = x + u64 165;
+x = x + u64 166;
+x = x + u64 167;
+x = x + u64 168;
+x = x + u64 169;
+x = x + u64 170;
+x = x + u64 171;
+x = x + u64 172;
+x = x + u64 173;
+x = x + u64 174;
+x = x + u64 175;
+x = x + u64 176;
+x = x + u64 177;
+x = x + u64 178;
+x = x + u64 179;
+x = x + u64 180;
+x = x + u64 181;
+x = x + u64 182;
+x = x + u64 183;
+x = x + u64 184;
+x = x + u64 185;
+x = x + u64 186;
+x = x + u64 187;
+x = x + u64 188;
+x = x + u64 189;
+x = x + u64 190;
+x = x + u64 191;
+x = x + u64 192;
+x = x + u64 193;
+x = x + u64 194;
+x = x + u64 195;
+x = x + u64 196;
+x = x + u64 197;
+x = x + u64 198;
+x = x + u64 199;
+x = x + u64 200;
+x = x + u64 201;
+x = x + u64 202;
+x = x + u64 203;
+x = x + u64 204;
+x = x + u64 205;
+x = x + u64 206;
+x = x + u64 207;
+x = x + u64 208;
+x = x + u64 209;
+x = x + u64 210;
+x = x + u64 211;
+x = x + u64 212;
+x = x + u64 213;
+x = x + u64 214;
+x = x + u64 215;
+x = x + u64 216;
+x = x + u64 217;
+x = x + u64 218;
+x = x + u64 219;
+x = x + u64 220;
+x = x + u64 221;
+x = x + u64 222;
+x = x + u64 223;
+x = x + u64 224;
+x = x + u64 225;
+x = x + u64 226;
+x = x + u64 227;
+x = x + u64 228;
+x = x + u64 229;
+x = x + u64 230;
+x = x + u64 231;
+x = x + u64 232;
+x = x + u64 233;
+x = x + u64 234;
+x = x + u64 235;
+x = x + u64 236;
+x = x + u64 237;
+x = x + u64 238;
+x = x + u64 239;
+x = x + u64 240;
+x = x + u64 241;
+x = x + u64 242;
+x = x + u64 243;
+x = x + u64 244;
+x = x + u64 245;
+x = x + u64 246;
+x = x + u64 247;
+x = x + u64 248;
+x = x + u64 249;
+x = x + u64 250;
+x = x + u64 251;
+x = x + u64 252;
+x = x + u64 253;
+x = x + u64 254;
+x = x + u64 255;
+x = x + u64 256;
+x = x + u64 257;
+x = x + u64 258;
+x = x + u64 259;
+x = x + u64 260;
+x = x + u64 261;
+x = x + u64 262;
+x = x + u64 263;
+x = x + u64 264;
+x = x + u64 265;
+x = x + u64 266;
+x = x + u64 267;
+x = x + u64 268;
+x = x + u64 269;
+x = x + u64 270;
+x = x + u64 271;
+x = x + u64 272;
+x = x + u64 273;
+x = x + u64 274;
+x = x + u64 275;
+x = x + u64 276;
+x = x + u64 277;
+x = x + u64 278;
+x = x + u64 279;
+x = x + u64 280;
+x = x + u64 281;
+x = x + u64 282;
+x = x + u64 283;
+x = x + u64 284;
+x = x + u64 285;
+x = x + u64 286;
+x = x + u64 287;
+x = x + u64 288;
+x = x + u64 289;
+x = x + u64 290;
+x = x + u64 291;
+x = x + u64 292;
+x = x + u64 293;
+x = x + u64 294;
+x = x + u64 295;
+x = x + u64 296;
+x = x + u64 297;
+x = x + u64 298;
+x = x + u64 299;
+x = x + u64 300;
+print x;
@@ -0,0 +1,6 @@
+# Every kind of node
+f := fun (x: u64) u64 {
+	print "a\"b\tc";
+	x.y[0] + -1;
+};
+f 101b, ();
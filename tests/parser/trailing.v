@@ -0,0 +1,2 @@
+f := (a, b, (c, (d, (e; ); ); ); );
+g (x -) (y, @z, ) [1, [2, [3, ], ], ];